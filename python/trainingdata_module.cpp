@@ -0,0 +1,375 @@
+// Python bindings of the in-process Converter. Batches are handed to Python
+// as objects implementing the buffer protocol, one contiguous C array per
+// field, so numpy.asarray() views them without copying. The arrays are the
+// TrainingDataColumns the Converter fills, with the GIL released, from the
+// game it just converted; the played move comes from the converter.
+//
+//   import numpy as np, trainingdata
+//   converter = trainingdata.Converter(batch_size=4096)
+//   for batch in converter.convert(open("games.pgn", "rb").read()):
+//       planes = np.asarray(batch.planes)      # uint64 [n, 104]
+//       played = np.asarray(batch.policy_index)  # int32 [n]
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <string>
+
+#include "converter.h"
+#include "utils/exception.h"
+
+namespace {
+
+// One field of a batch and its numpy layout. Fields with |columns| > 0 are
+// two dimensional.
+struct BatchField {
+  const char* name;
+  const char* format;
+  Py_ssize_t itemsize;
+  Py_ssize_t columns;
+  const char* doc;
+};
+
+enum {
+  PLANES,
+  POLICY_INDEX,
+  CASTLING,
+  SIDE_TO_MOVE,
+  RULE50_COUNT,
+  RESULT,
+  Q,
+  D,
+  GAME_ID,
+  kBatchFieldCount,
+};
+
+const BatchField kBatchFields[kBatchFieldCount] = {
+    {"planes", "Q", 8, 104,
+     "uint64 [n, 104], input planes as stored in V4 records"},
+    {"policy_index", "i", 4, 0, "int32 [n], policy index of the played move"},
+    {"castling", "B", 1, 4,
+     "uint8 [n, 4], castling rights: us O-O-O, us O-O, them O-O-O, them O-O"},
+    {"side_to_move", "B", 1, 0, "uint8 [n], 1 when black is to move"},
+    {"rule50_count", "B", 1, 0, "uint8 [n], plies since capture or pawn move"},
+    {"result", "b", 1, 0, "int8 [n], game result for the side to move"},
+    {"q", "f", 4, 0, "float32 [n], Q from the engine score"},
+    {"d", "f", 4, 0, "float32 [n], draw probability"},
+    {"game_id", "i", 4, 0, "int32 [n], game of every position"},
+};
+
+Py_ssize_t field_row_bytes(int field) {
+  const BatchField& f = kBatchFields[field];
+  return f.itemsize * (f.columns > 0 ? f.columns : 1);
+}
+
+// The array of |field| in |columns|.
+void* field_data(TrainingDataColumns* columns, int field) {
+  switch (field) {
+    case PLANES:
+      return columns->planes.data();
+    case POLICY_INDEX:
+      return columns->policy_index.data();
+    case CASTLING:
+      return columns->castling.data();
+    case SIDE_TO_MOVE:
+      return columns->side_to_move.data();
+    case RULE50_COUNT:
+      return columns->rule50_count.data();
+    case RESULT:
+      return columns->result.data();
+    case Q:
+      return columns->q.data();
+    case D:
+      return columns->d.data();
+    default:
+      return columns->game_ids.data();
+  }
+}
+
+// trainingdata.Batch
+
+struct BatchObject {
+  PyObject_HEAD Py_ssize_t size;
+  TrainingDataColumns* columns;
+};
+
+PyTypeObject BatchType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+void batch_dealloc(BatchObject* self) {
+  delete self->columns;
+  Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+Py_ssize_t batch_length(BatchObject* self) { return self->size; }
+
+// A view of one field of a batch, exported through the buffer protocol.
+
+struct ArrayObject {
+  PyObject_HEAD BatchObject* batch;
+  int field;
+  Py_ssize_t shape[2];
+  Py_ssize_t strides[2];
+};
+
+PyTypeObject ArrayType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+void array_dealloc(ArrayObject* self) {
+  Py_XDECREF(self->batch);
+  Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+int array_getbuffer(ArrayObject* self, Py_buffer* view, int flags) {
+  const BatchField& field = kBatchFields[self->field];
+  view->obj = reinterpret_cast<PyObject*>(self);
+  Py_INCREF(view->obj);
+  view->buf = field_data(self->batch->columns, self->field);
+  view->len = self->batch->size * field_row_bytes(self->field);
+  view->readonly = 0;
+  view->itemsize = field.itemsize;
+  view->format =
+      (flags & PyBUF_FORMAT) ? const_cast<char*>(field.format) : nullptr;
+  view->ndim = field.columns > 0 ? 2 : 1;
+  view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+  view->strides =
+      (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : nullptr;
+  view->suboffsets = nullptr;
+  view->internal = nullptr;
+  return 0;
+}
+
+PyBufferProcs array_buffer_procs = {
+    reinterpret_cast<getbufferproc>(array_getbuffer),
+    nullptr,
+};
+
+PyObject* batch_field(BatchObject* self, void* closure) {
+  int field = static_cast<int>(reinterpret_cast<intptr_t>(closure));
+  ArrayObject* array = PyObject_New(ArrayObject, &ArrayType);
+  if (!array) return nullptr;
+  Py_INCREF(self);
+  array->batch = self;
+  array->field = field;
+  array->shape[0] = self->size;
+  array->shape[1] = kBatchFields[field].columns;
+  array->strides[0] = field_row_bytes(field);
+  array->strides[1] = kBatchFields[field].itemsize;
+  return reinterpret_cast<PyObject*>(array);
+}
+
+PyGetSetDef batch_getset[kBatchFieldCount + 1];
+
+PySequenceMethods batch_sequence_methods;
+
+// trainingdata.Converter
+
+struct ConverterObject {
+  PyObject_HEAD Converter* converter;
+  // The PGN being read, kept alive while the converter reads from it.
+  Py_buffer input;
+  bool has_input;
+  bool busy;
+};
+
+PyTypeObject ConverterType = {PyVarObject_HEAD_INIT(nullptr, 0)};
+
+void release_input(ConverterObject* self) {
+  if (!self->has_input) return;
+  PyBuffer_Release(&self->input);
+  self->has_input = false;
+}
+
+PyObject* converter_new(PyTypeObject* type, PyObject*, PyObject*) {
+  ConverterObject* self =
+      reinterpret_cast<ConverterObject*>(type->tp_alloc(type, 0));
+  if (!self) return nullptr;
+  self->converter = nullptr;
+  self->has_input = false;
+  self->busy = false;
+  return reinterpret_cast<PyObject*>(self);
+}
+
+int converter_init(ConverterObject* self, PyObject* args, PyObject* kwargs) {
+  static const char* kKeywords[] = {"fishtest_mode", "q_scale", "batch_size",
+                                    nullptr};
+  int fishtest_mode = 0;
+  double q_scale = kDefaultScoreScale;
+  Py_ssize_t batch_size = 1024;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|pdn",
+                                   const_cast<char**>(kKeywords),
+                                   &fishtest_mode, &q_scale, &batch_size)) {
+    return -1;
+  }
+  if (batch_size < 1) {
+    PyErr_SetString(PyExc_ValueError, "batch_size must be positive");
+    return -1;
+  }
+  Options options;
+  options.fishtest_mode = fishtest_mode != 0;
+  options.score_scale = q_scale;
+  try {
+    delete self->converter;
+    self->converter = new Converter(options, batch_size);
+  } catch (const std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return -1;
+  }
+  return 0;
+}
+
+void converter_dealloc(ConverterObject* self) {
+  delete self->converter;
+  release_input(self);
+  Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+bool check_usable(ConverterObject* self) {
+  if (!self->converter) {
+    PyErr_SetString(PyExc_RuntimeError, "Converter is not initialized");
+    return false;
+  }
+  if (self->busy) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "Converter is in use by another thread");
+    return false;
+  }
+  return true;
+}
+
+PyObject* converter_convert(ConverterObject* self, PyObject* data) {
+  if (!check_usable(self)) return nullptr;
+  release_input(self);
+  if (PyObject_GetBuffer(data, &self->input, PyBUF_SIMPLE) != 0) {
+    return nullptr;
+  }
+  self->has_input = true;
+  try {
+    self->converter->Open(static_cast<const char*>(self->input.buf),
+                          static_cast<size_t>(self->input.len));
+  } catch (const std::exception& e) {
+    release_input(self);
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+    return nullptr;
+  }
+  Py_INCREF(self);
+  return reinterpret_cast<PyObject*>(self);
+}
+
+PyObject* converter_iternext(ConverterObject* self) {
+  if (!check_usable(self)) return nullptr;
+  if (!self->has_input) return nullptr;
+  bool have_batch = false;
+  // Owned by the Batch from here on, Python may keep views of it.
+  TrainingDataColumns* columns = new TrainingDataColumns;
+  std::string error;
+  self->busy = true;
+  Py_BEGIN_ALLOW_THREADS;
+  try {
+    have_batch = self->converter->Next(columns);
+  } catch (const std::exception& e) {
+    error = e.what();
+  }
+  Py_END_ALLOW_THREADS;
+  self->busy = false;
+  if (!error.empty() || !have_batch) {
+    delete columns;
+    if (!error.empty()) {
+      PyErr_SetString(PyExc_RuntimeError, error.c_str());
+    } else {
+      // StopIteration, the input is no longer needed.
+      release_input(self);
+    }
+    return nullptr;
+  }
+  BatchObject* batch = PyObject_New(BatchObject, &BatchType);
+  if (!batch) {
+    delete columns;
+    return nullptr;
+  }
+  batch->size = static_cast<Py_ssize_t>(columns->size);
+  batch->columns = columns;
+  return reinterpret_cast<PyObject*>(batch);
+}
+
+PyObject* converter_stats(ConverterObject* self, PyObject*) {
+  if (!check_usable(self)) return nullptr;
+  const ConversionStats& stats = self->converter->stats();
+  return Py_BuildValue(
+      "{s:K,s:K,s:K,s:K}", "games_read",
+      static_cast<unsigned long long>(stats.games_read), "games_accepted",
+      static_cast<unsigned long long>(stats.games_accepted), "games_rejected",
+      static_cast<unsigned long long>(stats.GamesRejected()),
+      "positions_written",
+      static_cast<unsigned long long>(stats.positions_written));
+}
+
+PyMethodDef converter_methods[] = {
+    {"convert", reinterpret_cast<PyCFunction>(converter_convert), METH_O,
+     "convert(pgn) -> iterator of Batch. |pgn| is any bytes-like object "
+     "holding one or more games."},
+    {"stats", reinterpret_cast<PyCFunction>(converter_stats), METH_NOARGS,
+     "Totals over everything converted so far."},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+PyModuleDef trainingdata_module = {
+    PyModuleDef_HEAD_INIT,
+    "trainingdata",
+    "Converts PGN games to lc0 training data in memory.",
+    -1,
+    nullptr,
+};
+
+}  // namespace
+
+PyMODINIT_FUNC PyInit_trainingdata() {
+  for (int i = 0; i < kBatchFieldCount; ++i) {
+    batch_getset[i].name = const_cast<char*>(kBatchFields[i].name);
+    batch_getset[i].get = reinterpret_cast<getter>(batch_field);
+    batch_getset[i].doc = const_cast<char*>(kBatchFields[i].doc);
+    batch_getset[i].closure =
+        reinterpret_cast<void*>(static_cast<intptr_t>(i));
+  }
+  batch_sequence_methods.sq_length =
+      reinterpret_cast<lenfunc>(batch_length);
+
+  BatchType.tp_name = "trainingdata.Batch";
+  BatchType.tp_basicsize = sizeof(BatchObject);
+  BatchType.tp_dealloc = reinterpret_cast<destructor>(batch_dealloc);
+  BatchType.tp_flags = Py_TPFLAGS_DEFAULT;
+  BatchType.tp_doc = "Positions of whole games, one array per field.";
+  BatchType.tp_getset = batch_getset;
+  BatchType.tp_as_sequence = &batch_sequence_methods;
+
+  ArrayType.tp_name = "trainingdata.Array";
+  ArrayType.tp_basicsize = sizeof(ArrayObject);
+  ArrayType.tp_dealloc = reinterpret_cast<destructor>(array_dealloc);
+  ArrayType.tp_flags = Py_TPFLAGS_DEFAULT;
+  ArrayType.tp_doc = "A batch field, use numpy.asarray() or memoryview().";
+  ArrayType.tp_as_buffer = &array_buffer_procs;
+
+  ConverterType.tp_name = "trainingdata.Converter";
+  ConverterType.tp_basicsize = sizeof(ConverterObject);
+  ConverterType.tp_dealloc = reinterpret_cast<destructor>(converter_dealloc);
+  ConverterType.tp_flags = Py_TPFLAGS_DEFAULT;
+  ConverterType.tp_doc =
+      "Converter(fishtest_mode=False, q_scale=0.4, batch_size=1024)";
+  ConverterType.tp_new = converter_new;
+  ConverterType.tp_init = reinterpret_cast<initproc>(converter_init);
+  ConverterType.tp_iter = PyObject_SelfIter;
+  ConverterType.tp_iternext =
+      reinterpret_cast<iternextfunc>(converter_iternext);
+  ConverterType.tp_methods = converter_methods;
+
+  if (PyType_Ready(&BatchType) < 0 || PyType_Ready(&ArrayType) < 0 ||
+      PyType_Ready(&ConverterType) < 0) {
+    return nullptr;
+  }
+  PyObject* module = PyModule_Create(&trainingdata_module);
+  if (!module) return nullptr;
+  Py_INCREF(&ConverterType);
+  PyModule_AddObject(module, "Converter",
+                     reinterpret_cast<PyObject*>(&ConverterType));
+  Py_INCREF(&BatchType);
+  PyModule_AddObject(module, "Batch", reinterpret_cast<PyObject*>(&BatchType));
+  return module;
+}
@@ -0,0 +1,510 @@
+#include "async_writer.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "stage_timer.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+
+AsyncTrainingDataWriter::AsyncTrainingDataWriter(const WriterOptions& options)
+    : options_(options),
+      game_pool_("game_buffers", options.memory_budget),
+      writer_pool_("writer_buffers", options.memory_budget),
+      shuffle_pool_("shuffle_buffer", options.memory_budget),
+      ring_pool_("shm_ring", options.memory_budget),
+      free_("free_buffers", std::max<size_t>(options.pool_size, 1)),
+      // Room for a flush marker on top of the whole pool.
+      pending_("pending_games", std::max<size_t>(options.pool_size, 1) + 1) {
+  size_t pool_size = options_.pool_size < 1 ? 1 : options_.pool_size;
+  for (size_t i = 0; i < pool_size; ++i) {
+    pool_.emplace_back(new GameRecords);
+    pool_.back()->records.reserve(kGameRecordsReserve);
+    pool_.back()->scores.reserve(kGameRecordsReserve);
+    free_.Push(pool_.back().get());
+  }
+  game_pool_.Charge(pool_size * GameBytes(kGameRecordsReserve));
+  if (options_.shuffle_buffer_size > 0 &&
+      options_.format != OutputFormat::GAME_STREAM) {
+    size_t shuffle_bytes =
+        options_.shuffle_buffer_size *
+            (sizeof(lczero::V4TrainingData) + sizeof(int)) +
+        options_.records_per_chunk *
+            (sizeof(lczero::V4TrainingData) + sizeof(int));
+    if (options_.memory_budget && options_.memory_budget->limit() > 0 &&
+        shuffle_bytes > options_.memory_budget->limit()) {
+      throw lczero::Exception("Shuffle buffer of " +
+                              std::to_string(shuffle_bytes >> 20) +
+                              " MB doesn't fit in the memory budget");
+    }
+    shuffle_pool_.Charge(shuffle_bytes);
+    shuffle_buffer_.reset(new ShuffleBuffer(options_.shuffle_buffer_size,
+                                            options_.shuffle_seed));
+    shuffled_chunk_.reserve(options_.records_per_chunk);
+    shuffled_chunk_games_.reserve(options_.records_per_chunk);
+  }
+  if (!options_.shm_ring_name.empty()) {
+    if (options_.format != OutputFormat::V4) {
+      throw lczero::Exception(
+          "Only V4 records can be published to shared memory");
+    }
+    ring_.reset(
+        new ShmRingProducer(options_.shm_ring_name, options_.shm_ring_records));
+    ring_pool_.Charge(ring_->capacity() * sizeof(lczero::V4TrainingData));
+  } else if (!options_.output_stream.empty()) {
+    if (options_.format == OutputFormat::GAME_STREAM) {
+      throw lczero::Exception("Game streams can't be written to a stream");
+    }
+    if (options_.output_stream == "-") {
+#if defined(_WIN32)
+      _setmode(_fileno(stdout), _O_BINARY);
+#endif
+      stream_ = stdout;
+    } else {
+      stream_ = std::fopen(options_.output_stream.c_str(), "wb");
+      if (!stream_) {
+        throw lczero::Exception("Cannot open " + options_.output_stream);
+      }
+    }
+    stream_buffer_.reserve(kStreamBufferBytes);
+  } else if (!options_.manifest_filename.empty()) {
+    manifest_.reset(new ManifestWriter(options_.manifest_filename));
+  }
+  if (!options_.output_directory.empty() && !stream_ && !ring_) {
+    lczero::CreateDirectory(options_.output_directory);
+  }
+  thread_ = std::thread([this]() { Worker(); });
+}
+
+AsyncTrainingDataWriter::~AsyncTrainingDataWriter() {
+  // Only reached without Finish() when the conversion already failed.
+  try {
+    Finish();
+  } catch (const std::exception&) {
+  }
+}
+
+GameRecords* AsyncTrainingDataWriter::Acquire() {
+  STAGE_TIMER(Stage::WRITER_WAIT);
+  GameRecords* game = nullptr;
+  bool have_game = free_.Pop(&game);
+  if (failed_.load(std::memory_order_acquire)) {
+    if (have_game) free_.Push(game);
+    std::rethrow_exception(error_);
+  }
+  return game;
+}
+
+size_t AsyncTrainingDataWriter::GameBytes(size_t entries) const {
+  // The converter also keeps a position per entry in its PositionHistory.
+  size_t entry_bytes = sizeof(lczero::Position);
+  if (options_.format == OutputFormat::GAME_STREAM) {
+    entry_bytes += sizeof(GameStreamPly);
+  } else {
+    entry_bytes += sizeof(lczero::V4TrainingData) + sizeof(float);
+  }
+  return entries * entry_bytes;
+}
+
+size_t AsyncTrainingDataWriter::GameBytes(const GameRecords& game) const {
+  return GameBytes(std::max(
+      game.stream.plies.capacity(),
+      std::max(game.records.capacity(), game.scores.capacity())));
+}
+
+void AsyncTrainingDataWriter::ReserveGameBytes(GameRecords* game,
+                                               size_t bytes) {
+  size_t initial = GameBytes(kGameRecordsReserve);
+  if (bytes <= initial + game->reserved_bytes) return;
+  size_t extra = bytes - initial - game->reserved_bytes;
+  game_pool_.Reserve(extra, game->reserved_bytes);
+  game->reserved_bytes += extra;
+}
+
+void AsyncTrainingDataWriter::Grow(GameRecords* game) {
+  size_t capacity =
+      options_.format == OutputFormat::GAME_STREAM
+          ? game->stream.plies.capacity()
+          : game->records.capacity();
+  capacity = std::max(kGameRecordsReserve, 2 * capacity);
+  ReserveGameBytes(game, GameBytes(capacity));
+  if (options_.format == OutputFormat::GAME_STREAM) {
+    game->stream.plies.reserve(capacity);
+  } else {
+    game->records.reserve(capacity);
+    game->scores.reserve(capacity);
+  }
+}
+
+void AsyncTrainingDataWriter::Submit(GameRecords* game) {
+  // Buffers filled without Grow() are accounted late.
+  ReserveGameBytes(game, GameBytes(*game));
+  pending_.Push(game);
+}
+
+void AsyncTrainingDataWriter::Release(GameRecords* game) {
+  // Keep the capacity around, the next game is likely of similar length.
+  // Under a memory limit, buffers that grew for a long game go back to
+  // their initial size instead.
+  if (game->reserved_bytes > 0 && options_.memory_budget &&
+      options_.memory_budget->limit() > 0) {
+    std::vector<lczero::V4TrainingData>().swap(game->records);
+    std::vector<float>().swap(game->scores);
+    std::vector<GameStreamPly>().swap(game->stream.plies);
+    game->records.reserve(kGameRecordsReserve);
+    game->scores.reserve(kGameRecordsReserve);
+    game_pool_.Release(game->reserved_bytes);
+    game->reserved_bytes = 0;
+  }
+  game->records.clear();
+  game->scores.clear();
+  game->stream.plies.clear();
+  free_.Push(game);
+}
+
+void AsyncTrainingDataWriter::Flush() {
+  std::lock_guard<std::mutex> serialize(flush_call_mutex_);
+  if (failed_.load(std::memory_order_acquire)) std::rethrow_exception(error_);
+  uint64_t done;
+  {
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    done = flushes_done_;
+  }
+  pending_.Push(&flush_marker_);
+  std::unique_lock<std::mutex> lock(flush_mutex_);
+  flush_done_.wait(lock, [&]() {
+    return flushes_done_ > done || failed_.load(std::memory_order_acquire);
+  });
+  if (flushes_done_ == done) std::rethrow_exception(error_);
+}
+
+void AsyncTrainingDataWriter::Finish() {
+  pending_.Close();
+  if (thread_.joinable()) thread_.join();
+  if (ring_) ring_->Close();
+  if (stream_) {
+    FlushStream();
+    if (stream_ == stdout) {
+      std::fflush(stream_);
+    } else {
+      std::fclose(stream_);
+    }
+    stream_ = nullptr;
+  }
+  if (error_) {
+    std::exception_ptr error = error_;
+    error_ = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+std::vector<QueueMetrics> AsyncTrainingDataWriter::queue_metrics() const {
+  return {free_.metrics(), pending_.metrics()};
+}
+
+void AsyncTrainingDataWriter::Worker() {
+  try {
+    WriteSubmittedGames();
+  } catch (...) {
+    // Converters see the error in Acquire(), the free buffers queue is
+    // closed so that none of them waits for a buffer forever.
+    error_ = std::current_exception();
+    failed_.store(true, std::memory_order_release);
+    free_.Close();
+    // Wakes a Flush() waiting for a marker that will never be reached.
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    flush_done_.notify_all();
+  }
+}
+
+void AsyncTrainingDataWriter::WriteSubmittedGames() {
+  std::vector<GameRecords*> games(pending_.capacity());
+  size_t count;
+  while ((count = pending_.PopBatch(games.data(), games.size())) > 0) {
+    for (size_t i = 0; i < count; ++i) {
+      GameRecords* game = games[i];
+      if (game == &flush_marker_) {
+        FlushSubmittedGames();
+        continue;
+      }
+      if (options_.format == OutputFormat::GAME_STREAM) {
+        AppendGameStream(*game);
+      } else if (shuffle_buffer_) {
+        ShuffleGame(*game);
+      } else {
+        WriteGame(*game);
+      }
+      Release(game);
+    }
+  }
+  if (shuffle_buffer_) FlushShuffleBuffer();
+  FlushGameStreams();
+}
+
+void AsyncTrainingDataWriter::FlushSubmittedGames() {
+  // Games are written one file each as they arrive, the shuffle buffer is
+  // left alone.
+  FlushGameStreams();
+  if (stream_) {
+    FlushStream();
+    std::fflush(stream_);
+  }
+  {
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    flushes_done_++;
+  }
+  flush_done_.notify_all();
+}
+
+void AsyncTrainingDataWriter::WriteGame(const GameRecords& game) {
+  if (ring_) {
+    PublishRecords(game.records, std::vector<int>{game.game_id});
+    return;
+  }
+  WriteRecords(game.directory, game.game_id, game.records,
+               std::vector<int>{game.game_id});
+}
+
+void AsyncTrainingDataWriter::AppendGameStream(const GameRecords& game) {
+  STAGE_TIMER(Stage::SERIALIZE);
+  if (stream_shards_.find(game.directory) == stream_shards_.end()) {
+    // One open shard per writer buffer is plenty for the converters feeding
+    // the writer. A single converter moves on to the next directory for
+    // good, so its previous one is flushed as soon as the next but one
+    // starts.
+    size_t max_shards = std::max<size_t>(options_.pool_size, 2);
+    while (stream_shards_.size() >= max_shards) {
+      auto oldest = std::min_element(
+          stream_shards_.begin(), stream_shards_.end(),
+          [](const std::pair<const std::string, StreamShard>& a,
+             const std::pair<const std::string, StreamShard>& b) {
+            return a.second.last_append < b.second.last_append;
+          });
+      FlushGameStream(oldest->first);
+    }
+  }
+  StreamShard& shard = stream_shards_[game.directory];
+  if (shard.data.empty()) append_game_stream_header(&shard.data);
+  append_game_stream(game.stream, &shard.data);
+  AccountWriterBuffers();
+  shard.games.push_back(game.game_id);
+  shard.last_append = stream_appends_++;
+  for (const auto& ply : game.stream.plies) {
+    if (!(ply.flags & kPlySkip)) shard.positions++;
+  }
+}
+
+void AsyncTrainingDataWriter::FlushGameStream(const std::string& directory) {
+  auto shard = stream_shards_.find(directory);
+  if (shard == stream_shards_.end()) return;
+  // Writers in several processes number the parts of all directories
+  // together, a single writer those of every directory from 0, and the
+  // first part of a directory keeps the plain name.
+  int part;
+  if (options_.shared_file_ids) {
+    part = (*options_.shared_file_ids)++;
+  } else {
+    int written = stream_parts_[directory]++;
+    part = written == 0 ? -1 : written;
+  }
+  std::string output_directory = OutputDirectory(directory);
+  WriteCompressed(output_directory,
+                  game_stream_filename(output_directory, part),
+                  shard->second.data.data(), shard->second.data.size(),
+                  shard->second.positions, shard->second.games);
+  stream_shards_.erase(shard);
+  AccountWriterBuffers();
+}
+
+void AsyncTrainingDataWriter::FlushGameStreams() {
+  std::vector<std::pair<uint64_t, std::string>> directories;
+  for (const auto& shard : stream_shards_) {
+    directories.emplace_back(shard.second.last_append, shard.first);
+  }
+  std::sort(directories.begin(), directories.end());
+  for (const auto& directory : directories) FlushGameStream(directory.second);
+}
+
+void AsyncTrainingDataWriter::ShuffleGame(const GameRecords& game) {
+  STAGE_TIMER(Stage::SHUFFLE);
+  lczero::V4TrainingData evicted;
+  int evicted_game_id;
+  for (const auto& record : game.records) {
+    if (!shuffle_buffer_->Insert(record, game.game_id, &evicted,
+                                 &evicted_game_id)) {
+      continue;
+    }
+    shuffled_chunk_.push_back(evicted);
+    shuffled_chunk_games_.push_back(evicted_game_id);
+    if (shuffled_chunk_.size() >= options_.records_per_chunk) {
+      WriteShuffledChunk();
+    }
+  }
+}
+
+void AsyncTrainingDataWriter::FlushShuffleBuffer() {
+  lczero::V4TrainingData record;
+  int game_id;
+  while (shuffle_buffer_->Extract(&record, &game_id)) {
+    shuffled_chunk_.push_back(record);
+    shuffled_chunk_games_.push_back(game_id);
+    if (shuffled_chunk_.size() >= options_.records_per_chunk) {
+      WriteShuffledChunk();
+    }
+  }
+  if (!shuffled_chunk_.empty()) WriteShuffledChunk();
+}
+
+void AsyncTrainingDataWriter::WriteShuffledChunk() {
+  if (ring_) {
+    PublishRecords(shuffled_chunk_, shuffled_chunk_games_);
+    shuffled_chunk_.clear();
+    shuffled_chunk_games_.clear();
+    return;
+  }
+  // Chunks are numbered on their own, they no longer map to single games.
+  int id = options_.shared_file_ids ? (*options_.shared_file_ids)++
+                                    : shuffled_chunk_id_++;
+  std::sort(shuffled_chunk_games_.begin(), shuffled_chunk_games_.end());
+  shuffled_chunk_games_.erase(
+      std::unique(shuffled_chunk_games_.begin(), shuffled_chunk_games_.end()),
+      shuffled_chunk_games_.end());
+  WriteRecords(
+      "supervised-" + std::to_string(id / options_.games_per_directory), id,
+      shuffled_chunk_, shuffled_chunk_games_);
+  shuffled_chunk_.clear();
+  shuffled_chunk_games_.clear();
+}
+
+void AsyncTrainingDataWriter::PublishRecords(
+    const std::vector<lczero::V4TrainingData>& records,
+    const std::vector<int>& game_ids) {
+  // Includes the time spent waiting for consumers to make room.
+  STAGE_TIMER(Stage::WRITE_FILE);
+  for (size_t i = 0; i < records.size(); ++i) {
+    ring_->Publish(records[i],
+                   game_ids.size() == 1 ? game_ids[0] : game_ids[i]);
+  }
+  if (options_.stats) options_.stats->positions_written += records.size();
+}
+
+void AsyncTrainingDataWriter::WriteRecords(
+    const std::string& directory, int id,
+    const std::vector<lczero::V4TrainingData>& records,
+    const std::vector<int>& game_ids) {
+  const void* data = records.data();
+  size_t size = records.size() * sizeof(lczero::V4TrainingData);
+  std::string filename =
+      training_data_filename(OutputDirectory(directory), id);
+  if (options_.format == OutputFormat::COMPACT) {
+    STAGE_TIMER(Stage::SERIALIZE);
+    compact_.resize(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+      if (!pack_compact_training_data(records[i], &compact_[i])) {
+        throw lczero::Exception("Record can't be stored in compact format");
+      }
+    }
+    data = compact_.data();
+    size = compact_.size() * sizeof(CompactTrainingData);
+    filename = compact_training_data_filename(OutputDirectory(directory), id);
+  }
+  if (stream_) {
+    AppendToStream(data, size, records.size());
+    return;
+  }
+  WriteCompressed(OutputDirectory(directory), filename, data, size,
+                  records.size(), game_ids);
+}
+
+std::string AsyncTrainingDataWriter::OutputDirectory(
+    const std::string& directory) const {
+  if (options_.output_directory.empty()) return directory;
+  return options_.output_directory + "/" + directory;
+}
+
+void AsyncTrainingDataWriter::AppendToStream(const void* data, size_t size,
+                                             size_t records) {
+  const char* bytes = static_cast<const char*>(data);
+  stream_buffer_.insert(stream_buffer_.end(), bytes, bytes + size);
+  if (options_.stats) options_.stats->positions_written += records;
+  if (stream_buffer_.size() >= kStreamBufferBytes) FlushStream();
+}
+
+void AsyncTrainingDataWriter::FlushStream() {
+  if (stream_buffer_.empty()) return;
+  const std::vector<char>* out = &stream_buffer_;
+  if (options_.stream_gzip) {
+    STAGE_TIMER(Stage::COMPRESS);
+    compressor_.Compress(stream_buffer_.data(), stream_buffer_.size(),
+                         &compressed_);
+    out = &compressed_;
+  }
+  AccountWriterBuffers();
+  {
+    STAGE_TIMER(Stage::WRITE_FILE);
+    if (std::fwrite(out->data(), 1, out->size(), stream_) != out->size()) {
+      throw lczero::Exception("Cannot write to " + options_.output_stream);
+    }
+  }
+  if (options_.stats) options_.stats->output_bytes += out->size();
+  stream_buffer_.clear();
+}
+
+void AsyncTrainingDataWriter::WriteCompressed(
+    const std::string& directory, const std::string& filename,
+    const void* data, size_t size, size_t records,
+    const std::vector<int>& game_ids) {
+  if (directory != last_directory_) {
+    lczero::CreateDirectory(directory);
+    last_directory_ = directory;
+  }
+  {
+    STAGE_TIMER(Stage::COMPRESS);
+    compressor_.Compress(data, size, &compressed_);
+  }
+  AccountWriterBuffers();
+  {
+    STAGE_TIMER(Stage::WRITE_FILE);
+    write_file(filename, compressed_.data(), compressed_.size());
+  }
+  if (options_.stats) {
+    options_.stats->positions_written += records;
+    options_.stats->files_written++;
+    options_.stats->output_bytes += compressed_.size();
+  }
+
+  if (manifest_) {
+    ManifestEntry entry;
+    entry.path = filename;
+    entry.game_ids = game_ids;
+    entry.records = records;
+    entry.compressed_bytes = compressed_.size();
+    entry.uncompressed_bytes = size;
+    entry.crc32 = static_cast<uint32_t>(
+        crc32(0L, reinterpret_cast<const Bytef*>(compressed_.data()),
+              static_cast<uInt>(compressed_.size())));
+    manifest_->Append(entry);
+  }
+}
+
+void AsyncTrainingDataWriter::AccountWriterBuffers() {
+  // The writer thread never waits for the budget, the converters wait for
+  // it instead.
+  size_t bytes = compressed_.capacity() +
+                 compact_.capacity() * sizeof(CompactTrainingData) +
+                 stream_buffer_.capacity();
+  for (const auto& shard : stream_shards_) {
+    bytes += shard.second.data.capacity();
+  }
+  if (bytes > writer_buffer_bytes_) {
+    writer_pool_.Charge(bytes - writer_buffer_bytes_);
+  } else {
+    writer_pool_.Refund(writer_buffer_bytes_ - bytes);
+  }
+  writer_buffer_bytes_ = bytes;
+}
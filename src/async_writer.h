@@ -0,0 +1,220 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chunk_writer.h"
+#include "compact_training_data.h"
+#include "game_stream.h"
+#include "manifest.h"
+#include "memory_budget.h"
+#include "mpmc_queue.h"
+#include "neural/writer.h"
+#include "shm_ring.h"
+#include "shuffle_buffer.h"
+#include "stats.h"
+
+// Records reserved up front in every pooled buffer; covers most games
+// without reallocating, longer ones grow the buffer once and keep it unless
+// there is a memory limit.
+const size_t kGameRecordsReserve = 160;
+
+enum class OutputFormat {
+  // lc0 V4TrainingData records, readable by the lc0 training pipeline.
+  V4,
+  // CompactTrainingData records, see compact_training_data.h.
+  COMPACT,
+  // One game stream file per directory, see game_stream.h.
+  GAME_STREAM,
+};
+
+// Bytes collected before the output stream is written to.
+const size_t kStreamBufferBytes = 4 << 20;
+
+struct WriterOptions {
+  OutputFormat format = OutputFormat::V4;
+  // The supervised-<N> directories are created in this directory, the
+  // current one when empty.
+  std::string output_directory;
+  // When set, the records of all games are written back to back to this
+  // file (usually a FIFO) or, for "-", to stdout instead of one file per
+  // game. The stream is gzip compressed in independent members when
+  // |stream_gzip| is set, raw otherwise.
+  std::string output_stream;
+  bool stream_gzip = false;
+  // Number of game buffers shared between the parser and the writer thread.
+  size_t pool_size = 2;
+  size_t games_per_directory = 10000;
+  // When non zero, records go through a shuffle buffer of this many records
+  // and are written in chunks of |records_per_chunk| instead of per game.
+  size_t shuffle_buffer_size = 0;
+  uint64_t shuffle_seed = 0;
+  size_t records_per_chunk = 1000;
+  // When set, every finished file is listed in this JSON lines file.
+  std::string manifest_filename;
+  // Receives the number of positions, files and bytes written when set.
+  ConversionStats* stats = nullptr;
+  // All buffers of the writer draw from this budget when set. Game buffers
+  // that grew past kGameRecordsReserve then give the memory back once they
+  // are written.
+  MemoryBudget* memory_budget = nullptr;
+  // Numbers the files holding records of several games (shuffled chunks,
+  // game stream parts) when writers in several processes share the output
+  // directories. Points to shared memory; null for a single writer.
+  std::atomic<int>* shared_file_ids = nullptr;
+  // When set, V4 records are published to the shared memory ring of this
+  // name (see shm_ring.h) instead of being written to files.
+  std::string shm_ring_name;
+  size_t shm_ring_records = kDefaultShmRingRecords;
+};
+
+// Training records of a single game, waiting to be written to disk.
+struct GameRecords {
+  int game_id = 0;
+  std::string directory;
+  std::vector<lczero::V4TrainingData> records;
+  // Engine score of every record while the game is being converted.
+  std::vector<float> scores;
+  // Policy index of the played move of every record, only filled when
+  // converting without a writer.
+  std::vector<int> policy_indices;
+  // Used instead of |records| with OutputFormat::GAME_STREAM.
+  GameStream stream;
+  // Memory reserved from the budget beyond the buffer's initial size.
+  size_t reserved_bytes = 0;
+};
+
+// Moves compression and file I/O off the parsing thread. Converters take a
+// buffer from a fixed pool, fill it with one game and submit it; a dedicated
+// thread compresses the whole game in one go, writes it out and returns the
+// buffer to the pool. A game that fails halfway is simply released, so no
+// partial file is ever produced. The writer thread takes the submitted games
+// in batches. When all buffers are in flight Acquire() blocks, which bounds
+// memory use and throttles the parser to the speed of the disk.
+class AsyncTrainingDataWriter {
+ public:
+  explicit AsyncTrainingDataWriter(const WriterOptions& options);
+  ~AsyncTrainingDataWriter();
+
+  // Returns an empty buffer from the pool, waiting for one if necessary.
+  // Rethrows the error that stopped the writer thread, if any.
+  GameRecords* Acquire();
+  // Makes room for twice as many records (or game stream plies) in |game|,
+  // waiting for the memory budget before allocating. Converters call it
+  // when the buffer is full.
+  void Grow(GameRecords* game);
+  // Queues a filled buffer for writing. Ownership returns to the pool.
+  void Submit(GameRecords* game);
+  // Returns a buffer to the pool without writing it.
+  void Release(GameRecords* game);
+  // Waits until everything submitted so far is written out, except the
+  // records a shuffle buffer holds back, which only Finish() writes. Open
+  // game stream directories are written as parts of their own. Rethrows the
+  // error that stopped the writer thread, if any. Not after Finish().
+  void Flush();
+  // Writes out everything submitted so far and stops the writer thread.
+  // Rethrows the error that stopped the writer thread, if any.
+  void Finish();
+
+  // Occupancy of the queue of free buffers and of the queue of games
+  // waiting for the writer thread.
+  std::vector<QueueMetrics> queue_metrics() const;
+
+ private:
+  void Worker();
+  void WriteSubmittedGames();
+  // Writes out what the writer thread holds when it reaches a Flush().
+  void FlushSubmittedGames();
+  // Memory held by a game buffer with room for |entries| records or plies.
+  size_t GameBytes(size_t entries) const;
+  size_t GameBytes(const GameRecords& game) const;
+  // Reserves what |game| needs beyond the initial size when it has grown.
+  void ReserveGameBytes(GameRecords* game, size_t bytes);
+  void AccountWriterBuffers();
+  void WriteGame(const GameRecords& game);
+  // |game_ids| holds the game of every record, or a single one for all.
+  void PublishRecords(const std::vector<lczero::V4TrainingData>& records,
+                      const std::vector<int>& game_ids);
+  void AppendGameStream(const GameRecords& game);
+  // Writes the game streams collected for |directory| as its next part.
+  void FlushGameStream(const std::string& directory);
+  // Flushes every directory, least recently used first.
+  void FlushGameStreams();
+  void ShuffleGame(const GameRecords& game);
+  void FlushShuffleBuffer();
+  void WriteShuffledChunk();
+  void WriteRecords(const std::string& directory, int id,
+                    const std::vector<lczero::V4TrainingData>& records,
+                    const std::vector<int>& game_ids);
+  void AppendToStream(const void* data, size_t size, size_t records);
+  void FlushStream();
+  // |directory| below options_.output_directory.
+  std::string OutputDirectory(const std::string& directory) const;
+  void WriteCompressed(const std::string& directory,
+                       const std::string& filename, const void* data,
+                       size_t size, size_t records,
+                       const std::vector<int>& game_ids);
+
+  const WriterOptions options_;
+  MemoryPool game_pool_;
+  MemoryPool writer_pool_;
+  MemoryPool shuffle_pool_;
+  MemoryPool ring_pool_;
+  size_t writer_buffer_bytes_ = 0;
+  std::vector<std::unique_ptr<GameRecords>> pool_;
+  // Buffers move between the converters and the writer thread through
+  // lock-free queues, each large enough for the whole pool.
+  MpmcQueue<GameRecords*> free_;
+  MpmcQueue<GameRecords*> pending_;
+
+  // Only touched by the writer thread.
+  GzipCompressor compressor_;
+  std::vector<char> compressed_;
+  std::vector<CompactTrainingData> compact_;
+  std::string last_directory_;
+  std::unique_ptr<ShuffleBuffer> shuffle_buffer_;
+  std::vector<lczero::V4TrainingData> shuffled_chunk_;
+  std::vector<int> shuffled_chunk_games_;
+  int shuffled_chunk_id_ = 0;
+  std::unique_ptr<ManifestWriter> manifest_;
+  std::unique_ptr<ShmRingProducer> ring_;
+  std::FILE* stream_ = nullptr;
+  std::vector<char> stream_buffer_;
+  // Serialized game streams of the directories games arrived for recently.
+  // With several converters games of neighbouring directories arrive
+  // interleaved, so a shard is only flushed when too many are open or at
+  // the end, and a directory written in several parts gets numbered ones.
+  struct StreamShard {
+    std::vector<char> data;
+    std::vector<int> games;
+    size_t positions = 0;
+    uint64_t last_append = 0;
+  };
+  std::map<std::string, StreamShard> stream_shards_;
+  // Parts written so far per directory.
+  std::map<std::string, int> stream_parts_;
+  uint64_t stream_appends_ = 0;
+
+  // Flush() queues |flush_marker_| behind the submitted games, one caller
+  // at a time, and waits for the writer thread to count it in
+  // |flushes_done_|.
+  GameRecords flush_marker_;
+  std::mutex flush_call_mutex_;
+  std::mutex flush_mutex_;
+  std::condition_variable flush_done_;
+  uint64_t flushes_done_ = 0;
+
+  std::thread thread_;
+  // First error of the writer thread, which then stops writing. Set before
+  // |failed_|.
+  std::exception_ptr error_;
+  std::atomic<bool> failed_{false};
+};
@@ -0,0 +1,93 @@
+#include "chunk_writer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "utils/exception.h"
+
+GzipCompressor::GzipCompressor() {
+  std::memset(&stream_, 0, sizeof(stream_));
+  // 15 window bits plus 16 selects the gzip wrapper, so the output can be
+  // read back with gzopen() just like files written by lc0.
+  if (deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw lczero::Exception("Cannot initialize zlib");
+  }
+}
+
+GzipCompressor::~GzipCompressor() { deflateEnd(&stream_); }
+
+void GzipCompressor::Compress(const void* data, size_t size,
+                              std::vector<char>* out) {
+  deflateReset(&stream_);
+  out->resize(deflateBound(&stream_, static_cast<uLong>(size)));
+  stream_.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+  stream_.avail_in = static_cast<uInt>(size);
+  stream_.next_out = reinterpret_cast<Bytef*>(out->data());
+  stream_.avail_out = static_cast<uInt>(out->size());
+  // deflateBound() guarantees that one call with Z_FINISH is enough.
+  if (deflate(&stream_, Z_FINISH) != Z_STREAM_END) {
+    throw lczero::Exception("zlib compression failed");
+  }
+  out->resize(stream_.total_out);
+}
+
+void write_file(const std::string& filename, const void* data, size_t size) {
+  FILE* f = std::fopen(filename.c_str(), "wb");
+  if (!f) throw lczero::Exception("Cannot create file " + filename);
+  bool ok = std::fwrite(data, 1, size, f) == size;
+  ok = std::fclose(f) == 0 && ok;
+  if (!ok) throw lczero::Exception("Cannot write file " + filename);
+}
+
+namespace {
+
+// "game_000042", padded to six digits like lczero::TrainingDataWriter does,
+// so that the files of a directory sort by game id.
+std::string game_file_prefix(const std::string& directory, int game_id) {
+  std::ostringstream name;
+  name << directory << "/game_" << std::setfill('0') << std::setw(6)
+       << game_id;
+  return name.str();
+}
+
+}  // namespace
+
+std::string training_data_filename(const std::string& directory,
+                                   int game_id) {
+  return game_file_prefix(directory, game_id) + ".gz";
+}
+
+std::string compact_training_data_filename(const std::string& directory,
+                                           int game_id) {
+  return game_file_prefix(directory, game_id) + ".compact.gz";
+}
+
+std::string game_stream_filename(const std::string& directory, int part) {
+  if (part >= 0) {
+    return directory + "/games." + std::to_string(part) + ".tdgs.gz";
+  }
+  return directory + "/games.tdgs.gz";
+}
+
+void read_compressed_file(const std::string& filename,
+                          std::vector<char>* data) {
+  gzFile file = gzopen(filename.c_str(), "rb");
+  if (!file) throw lczero::Exception("Cannot open " + filename);
+  data->clear();
+  const size_t kReadSize = 1 << 20;
+  while (true) {
+    size_t offset = data->size();
+    data->resize(offset + kReadSize);
+    int bytes = gzread(file, data->data() + offset, kReadSize);
+    if (bytes < 0) {
+      gzclose(file);
+      throw lczero::Exception("Cannot read " + filename);
+    }
+    data->resize(offset + bytes);
+    if (bytes == 0) break;
+  }
+  gzclose(file);
+}
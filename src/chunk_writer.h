@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "zlib.h"
+
+// Compresses whole buffers into gzip members with a single deflate() call.
+// The zlib state is allocated once and reset between buffers.
+class GzipCompressor {
+ public:
+  GzipCompressor();
+  ~GzipCompressor();
+
+  // Replaces the contents of |out| with the gzip encoding of |data|.
+  void Compress(const void* data, size_t size, std::vector<char>* out);
+
+ private:
+  z_stream stream_;
+};
+
+// Writes |size| bytes to |filename|, replacing the file if it exists.
+void write_file(const std::string& filename, const void* data, size_t size);
+
+// Loads and decompresses a gzip file written by write_file() or lc0.
+void read_compressed_file(const std::string& filename, std::vector<char>* data);
+
+// Name of the training data file for |game_id|, game_<id>.gz with the id
+// padded to six digits, exactly as lczero::TrainingDataWriter names it.
+std::string training_data_filename(const std::string& directory, int game_id);
+
+// Same as above for files holding CompactTrainingData records.
+std::string compact_training_data_filename(const std::string& directory,
+                                           int game_id);
+
+// Name of the game stream file holding the games of |directory|, or of one
+// of its numbered parts when the directory is written in several parts.
+std::string game_stream_filename(const std::string& directory, int part = -1);
@@ -0,0 +1,132 @@
+#pragma once
+
+// Compact record format for supervised training data, and the expander that
+// turns it back into lc0 V4 records. This header has no dependencies besides
+// lc0's writer.h so it can be dropped into a training pipeline as is.
+//
+// Supervised records only carry one bit of information per policy entry
+// (legal or not) plus the index of the move that was played, and root/best
+// values are always equal. Storing that instead of 1858 floats shrinks each
+// record from 8292 to 1090 bytes, and expansion reproduces the original V4
+// record byte for byte.
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "neural/writer.h"
+
+// "CK" followed by the format revision. V4 files start with version 4, so the
+// two kinds of records can't be mistaken for each other.
+const uint32_t kCompactTrainingDataVersion = 0x434b0001;
+const int kPolicySize = 1858;
+const int kLegalMoveWords = (kPolicySize + 63) / 64;
+
+#pragma pack(push, 1)
+struct CompactTrainingData {
+  uint32_t version;
+  uint64_t planes[104];
+  // Bit i is set when policy index i is a legal move.
+  uint64_t legal_moves[kLegalMoveWords];
+  uint16_t played_move;
+  // Bit 0..3: castling us_ooo, us_oo, them_ooo, them_oo. Bit 4: side to move.
+  uint8_t flags;
+  uint8_t rule50_count;
+  uint8_t move_count;
+  int8_t result;
+  float q;
+  float d;
+};
+#pragma pack(pop)
+
+inline int compact_lowest_bit(uint64_t v) {
+#if defined(_MSC_VER)
+  unsigned long idx;
+  _BitScanForward64(&idx, v);
+  return static_cast<int>(idx);
+#else
+  return __builtin_ctzll(v);
+#endif
+}
+
+// Illegal policy entries are filled with 0xff bytes by the converter (a NaN
+// when read as float), legal ones with 0 and the played move with 1.
+inline bool compact_is_illegal_entry(float p) {
+  uint32_t bits;
+  std::memcpy(&bits, &p, sizeof(bits));
+  return bits == 0xffffffff;
+}
+
+// Fills |out| from |in|. Returns false when |in| carries information the
+// compact format can't hold, e.g. a real search policy.
+inline bool pack_compact_training_data(const lczero::V4TrainingData& in,
+                                       CompactTrainingData* out) {
+  if (in.root_q != in.best_q || in.root_d != in.best_d) return false;
+  if ((in.castling_us_ooo | in.castling_us_oo | in.castling_them_ooo |
+       in.castling_them_oo | in.side_to_move) > 1) {
+    return false;
+  }
+
+  std::memset(out->legal_moves, 0, sizeof(out->legal_moves));
+  int played = -1;
+  for (int i = 0; i < kPolicySize; ++i) {
+    float p = in.probabilities[i];
+    if (compact_is_illegal_entry(p)) continue;
+    if (p == 1.0f && played < 0) {
+      played = i;
+    } else if (p != 0.0f) {
+      return false;
+    }
+    out->legal_moves[i / 64] |= 1ull << (i % 64);
+  }
+  if (played < 0) return false;
+
+  out->version = kCompactTrainingDataVersion;
+  std::memcpy(out->planes, in.planes, sizeof(out->planes));
+  out->played_move = static_cast<uint16_t>(played);
+  out->flags = in.castling_us_ooo | in.castling_us_oo << 1 |
+               in.castling_them_ooo << 2 | in.castling_them_oo << 3 |
+               in.side_to_move << 4;
+  out->rule50_count = in.rule50_count;
+  out->move_count = in.move_count;
+  out->result = in.result;
+  out->q = in.root_q;
+  out->d = in.root_d;
+  return true;
+}
+
+// Rebuilds the V4 record that |in| was packed from.
+inline void expand_compact_training_data(const CompactTrainingData& in,
+                                         lczero::V4TrainingData* out) {
+  out->version = 4;
+  std::memset(out->probabilities, 0xff, sizeof(out->probabilities));
+  for (int word = 0; word < kLegalMoveWords; ++word) {
+    for (uint64_t bits = in.legal_moves[word]; bits; bits &= bits - 1) {
+      out->probabilities[word * 64 + compact_lowest_bit(bits)] = 0.0f;
+    }
+  }
+  out->probabilities[in.played_move] = 1.0f;
+  std::memcpy(out->planes, in.planes, sizeof(out->planes));
+  out->castling_us_ooo = in.flags & 1;
+  out->castling_us_oo = (in.flags >> 1) & 1;
+  out->castling_them_ooo = (in.flags >> 2) & 1;
+  out->castling_them_oo = (in.flags >> 3) & 1;
+  out->side_to_move = (in.flags >> 4) & 1;
+  out->rule50_count = in.rule50_count;
+  out->move_count = in.move_count;
+  out->result = in.result;
+  out->root_q = out->best_q = in.q;
+  out->root_d = out->best_d = in.d;
+}
+
+// Expands |count| consecutive records, e.g. a decompressed output file.
+inline void expand_compact_training_data(const CompactTrainingData* in,
+                                         size_t count,
+                                         lczero::V4TrainingData* out) {
+  for (size_t i = 0; i < count; ++i) {
+    expand_compact_training_data(in[i], &out[i]);
+  }
+}
@@ -0,0 +1,147 @@
+#include "converter.h"
+
+#include <cstring>
+
+#include "chess/board.h"
+#include "polyglot_lib.h"
+#include "utils/exception.h"
+
+namespace {
+
+void initialize_tables() {
+  // Thread safe since C++11.
+  static const bool initialized = []() {
+    lczero::InitializeMagicBitboards();
+    polyglot_init();
+    return true;
+  }();
+  (void)initialized;
+}
+
+}  // namespace
+
+void TrainingDataColumns::Clear() {
+  size = 0;
+  planes.clear();
+  policy_index.clear();
+  castling.clear();
+  side_to_move.clear();
+  rule50_count.clear();
+  result.clear();
+  q.clear();
+  d.clear();
+  game_ids.clear();
+}
+
+Converter::Converter(const Options& options, size_t batch_size)
+    : options_(options),
+      batch_size_(batch_size),
+      score_to_q_(logistic_score_model(options.score_scale)) {
+  initialize_tables();
+  options_.game_stream = false;
+}
+
+Converter::~Converter() { Close(); }
+
+void Converter::Open(const char* data, size_t size) {
+  Close();
+  if (size == 0) return;
+  if (!pgn_open_memory(pgn_, data, size)) {
+    throw lczero::Exception("Cannot read PGN from memory");
+  }
+  stats_.input_bytes += size;
+  open_ = true;
+}
+
+void Converter::Close() {
+  if (!open_) return;
+  pgn_close(pgn_);
+  open_ = false;
+}
+
+bool Converter::NextGame() {
+  while (open_) {
+    bool have_game;
+    try {
+      have_game = next_game(pgn_);
+    } catch (const PolyglotError&) {
+      Close();
+      throw;
+    }
+    if (!have_game) {
+      Close();
+      break;
+    }
+    game_.records.clear();
+    game_.scores.clear();
+    game_.policy_indices.clear();
+    bool converted;
+    try {
+      converted = convert_game(pgn_, next_game_id_, options_, score_to_q_,
+                               &game_, &stats_, nullptr);
+    } catch (const PolyglotError&) {
+      stats_.Reject(RejectReason::PARSE_ERROR);
+      Close();
+      throw;
+    }
+    if (!converted) continue;
+    stats_.positions_written += game_.records.size();
+    return true;
+  }
+  return false;
+}
+
+bool Converter::Next(TrainingDataBatch* batch) {
+  batch->records.clear();
+  batch->game_ids.clear();
+  while (batch->records.size() < batch_size_ && NextGame()) {
+    batch->records.insert(batch->records.end(), game_.records.begin(),
+                          game_.records.end());
+    batch->game_ids.insert(batch->game_ids.end(), game_.records.size(),
+                           next_game_id_);
+    next_game_id_++;
+  }
+  return !batch->records.empty();
+}
+
+bool Converter::Next(TrainingDataColumns* columns) {
+  columns->Clear();
+  while (columns->size < batch_size_ && NextGame()) {
+    size_t n = game_.records.size();
+    size_t row = columns->size;
+    columns->size += n;
+    columns->planes.resize(columns->size * 104);
+    columns->castling.resize(columns->size * 4);
+    uint64_t* planes = columns->planes.data() + row * 104;
+    uint8_t* castling = columns->castling.data() + row * 4;
+    for (const auto& record : game_.records) {
+      std::memcpy(planes, record.planes, sizeof(record.planes));
+      planes += 104;
+      castling[0] = record.castling_us_ooo;
+      castling[1] = record.castling_us_oo;
+      castling[2] = record.castling_them_ooo;
+      castling[3] = record.castling_them_oo;
+      castling += 4;
+      columns->side_to_move.push_back(record.side_to_move);
+      columns->rule50_count.push_back(record.rule50_count);
+      columns->result.push_back(record.result);
+      columns->q.push_back(record.root_q);
+      columns->d.push_back(record.root_d);
+    }
+    columns->policy_index.insert(columns->policy_index.end(),
+                                 game_.policy_indices.begin(),
+                                 game_.policy_indices.end());
+    columns->game_ids.insert(columns->game_ids.end(), n, next_game_id_);
+    next_game_id_++;
+  }
+  return columns->size > 0;
+}
+
+size_t Converter::Convert(const char* data, size_t size,
+                          const BatchCallback& callback) {
+  int first_game_id = next_game_id_;
+  Open(data, size);
+  TrainingDataBatch batch;
+  while (Next(&batch)) callback(batch);
+  return next_game_id_ - first_game_id;
+}
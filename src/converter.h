@@ -0,0 +1,93 @@
+#pragma once
+
+// In-process conversion of PGN text to training records, for embedding the
+// converter in other programs. Nothing touches the file system or starts
+// threads, and Converters share no state, so several can run concurrently.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "async_writer.h"
+#include "neural/writer.h"
+#include "pgn.h"
+#include "pgn_converter.h"
+#include "score_to_q.h"
+#include "stats.h"
+
+struct TrainingDataBatch {
+  std::vector<lczero::V4TrainingData> records;
+  // Game every record comes from, numbered from 0 per Converter.
+  std::vector<int> game_ids;
+};
+
+// A batch as one contiguous array per field, ready to be viewed by training
+// pipelines. Filled straight from the converted games: only the records of
+// the game being converted exist as V4 records, and the played move comes
+// from the converter rather than from the probabilities.
+struct TrainingDataColumns {
+  size_t size = 0;
+  // Input planes as stored in V4 records, 104 per position.
+  std::vector<uint64_t> planes;
+  // Policy index of the played move.
+  std::vector<int32_t> policy_index;
+  // Castling rights, 4 per position: us O-O-O, us O-O, them O-O-O, them O-O.
+  std::vector<uint8_t> castling;
+  // 1 when black is to move.
+  std::vector<uint8_t> side_to_move;
+  std::vector<uint8_t> rule50_count;
+  // Game result for the side to move.
+  std::vector<int8_t> result;
+  std::vector<float> q;
+  std::vector<float> d;
+  // Game every position comes from, numbered from 0 per Converter.
+  std::vector<int32_t> game_ids;
+
+  void Clear();
+};
+
+class Converter {
+ public:
+  using BatchCallback = std::function<void(const TrainingDataBatch& batch)>;
+
+  // Batches hold whole games and at least |batch_size| records, except for
+  // the last one. Options::game_stream is ignored.
+  explicit Converter(const Options& options = Options(),
+                     size_t batch_size = 1024);
+  ~Converter();
+
+  // Starts reading |size| bytes of PGN text: a whole file, or the span of a
+  // single game. |data| must stay valid until Next() returns false or the
+  // next Open(). Throws when PGN can't be read from memory on this system.
+  void Open(const char* data, size_t size);
+  // Fills |batch| with the next records. Returns false once the input is
+  // exhausted and |batch| is empty. Throws PolyglotError on a PGN syntax
+  // error, after which the input is closed and the records of the batch so
+  // far are lost.
+  bool Next(TrainingDataBatch* batch);
+  // The same, one array per field.
+  bool Next(TrainingDataColumns* columns);
+
+  // Open() and Next() in one go: converts every game in |data| and hands
+  // each batch to |callback|. Returns the number of games converted.
+  size_t Convert(const char* data, size_t size, const BatchCallback& callback);
+
+  // Totals over everything converted so far.
+  const ConversionStats& stats() const { return stats_; }
+
+ private:
+  void Close();
+  // Converts the next game with training data into |game_|. Returns false
+  // at the end of the input.
+  bool NextGame();
+
+  Options options_;
+  const size_t batch_size_;
+  const ScoreToQ score_to_q_;
+  ConversionStats stats_;
+  GameRecords game_;
+  pgn_t pgn_[1];
+  bool open_ = false;
+  int next_game_id_ = 0;
+};
@@ -0,0 +1,112 @@
+#include "eval_comment.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <regex>
+#include <string>
+
+namespace {
+
+const float kMateScore = 128.0f;
+
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// Skips a run of digits starting at |p|, returns nullptr if there is none.
+inline const char* skip_digits(const char* p) {
+  if (!is_digit(*p)) return nullptr;
+  while (is_digit(*p)) ++p;
+  return p;
+}
+
+// Reads an optional ",<depth>" or "/<depth>" suffix.
+inline int parse_depth(const char* p) {
+  if (*p != ',' && *p != '/') return -1;
+  ++p;
+  if (!is_digit(*p)) return -1;
+  return std::atoi(p);
+}
+
+// Lichess "[%eval <score>]" and "[%eval #<moves>]".
+bool parse_lichess_eval(const char* comment, EvalComment* eval) {
+  const char* p = std::strstr(comment, "[%eval");
+  if (!p) return false;
+  p += 6;
+  while (*p == ' ') ++p;
+  if (*p == '#') {
+    ++p;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') ++p;
+    const char* end = skip_digits(p);
+    if (!end) return false;
+    eval->score = negative ? -kMateScore : kMateScore;
+    eval->mate = true;
+    eval->depth = parse_depth(end);
+    return true;
+  }
+  const char* start = p;
+  if (*p == '-' || *p == '+') ++p;
+  const char* end = skip_digits(p);
+  if (!end) return false;
+  if (*end == '.') {
+    const char* fraction_end = skip_digits(end + 1);
+    if (fraction_end) end = fraction_end;
+  }
+  eval->score = std::strtof(start, nullptr);
+  eval->mate = false;
+  eval->depth = parse_depth(end);
+  return true;
+}
+
+// Fishtest "<score>/<depth>", matching the leftmost "-?\d+\.\d+/" like the
+// regex did, then "#-?\d+/" for mates.
+bool parse_fishtest_eval(const char* comment, EvalComment* eval) {
+  for (const char* start = comment; *start; ++start) {
+    const char* p = start;
+    if (*p == '-') ++p;
+    p = skip_digits(p);
+    if (!p || *p != '.') continue;
+    p = skip_digits(p + 1);
+    if (!p || *p != '/') continue;
+    eval->score = std::strtof(start, nullptr);
+    eval->mate = false;
+    eval->depth = parse_depth(p);
+    return true;
+  }
+  for (const char* start = std::strchr(comment, '#'); start;
+       start = std::strchr(start + 1, '#')) {
+    const char* p = start + 1;
+    bool negative = *p == '-';
+    if (negative) ++p;
+    p = skip_digits(p);
+    if (!p || *p != '/') continue;
+    eval->score = negative ? -kMateScore : kMateScore;
+    eval->mate = true;
+    eval->depth = parse_depth(p);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+bool parse_eval_comment(const char* comment, EvalComment* eval) {
+  return parse_lichess_eval(comment, eval) ||
+         parse_fishtest_eval(comment, eval);
+}
+
+bool parse_eval_comment_regex(const char* comment, EvalComment* eval) {
+  std::string s(comment);
+  static std::regex rgx("(-?\\d+\\.\\d+)/");
+  static std::regex rgx2("#(-?\\d+)/");
+  std::smatch matches;
+  if (std::regex_search(s, matches, rgx)) {
+    eval->score = std::stof(matches[1].str());
+    eval->mate = false;
+    return true;
+  } else if (std::regex_search(s, matches, rgx2)) {
+    eval->score = matches[1].str().at(0) == '-' ? -kMateScore : kMateScore;
+    eval->mate = true;
+    return true;
+  }
+  return false;
+}
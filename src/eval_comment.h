@@ -0,0 +1,19 @@
+#pragma once
+
+// Engine evaluation in a PGN move comment. Scores are in pawns from White's
+// point of view, mates are reported as +/-128.
+struct EvalComment {
+  float score = 0.0f;
+  // Search depth when the comment has one, -1 otherwise.
+  int depth = -1;
+  bool mate = false;
+};
+
+// Extracts the evaluation from |comment| in a single pass without allocating.
+// Understands Lichess "[%eval 0.23]", "[%eval #-3]" (optionally followed by
+// ",<depth>") and fishtest "+0.45/20 1.2s", "#-3/20" comments.
+bool parse_eval_comment(const char* comment, EvalComment* eval);
+
+// Reference implementation of the fishtest forms on top of std::regex, as the
+// converter used to do it. Kept to cross-check parse_eval_comment().
+bool parse_eval_comment_regex(const char* comment, EvalComment* eval);
@@ -0,0 +1,178 @@
+#include "game_stream.h"
+
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "chunk_writer.h"
+#include "training_data.h"
+#include "utils/exception.h"
+
+uint16_t encode_game_stream_move(lczero::Move move) {
+  int castling = move.castling() ? 1 : 0;
+  return static_cast<uint16_t>(move.to().as_int() | move.from().as_int() << 6 |
+                               static_cast<int>(move.promotion()) << 12 |
+                               castling << 15);
+}
+
+lczero::Move decode_game_stream_move(uint16_t move) {
+  lczero::Move m(lczero::BoardSquare(static_cast<uint8_t>((move >> 6) & 63)),
+                 lczero::BoardSquare(static_cast<uint8_t>(move & 63)));
+  m.SetPromotion(static_cast<lczero::Move::Promotion>((move >> 12) & 7));
+  if (move & 0x8000) m.SetCastling();
+  return m;
+}
+
+GameStreamPly make_game_stream_ply(lczero::Move move, bool skip,
+                                   bool has_score, float score) {
+  GameStreamPly ply;
+  ply.move = encode_game_stream_move(move);
+  if (skip) ply.flags |= kPlySkip;
+  if (has_score) {
+    ply.flags |= kPlyHasScore;
+    ply.score = score;
+    // Comments carry two decimals, so almost every score survives the round
+    // trip through whole centipawns. Anything else is kept as a float.
+    long cp = std::lround(score * 100.0f);
+    if (cp >= INT16_MIN && cp <= INT16_MAX &&
+        static_cast<float>(cp) / 100.0f == score) {
+      ply.score_cp = static_cast<int16_t>(cp);
+    } else {
+      ply.flags |= kPlyExtendedScore;
+    }
+  }
+  return ply;
+}
+
+namespace {
+
+template <typename T>
+void append_value(T value, std::vector<char>* out) {
+  const char* bytes = reinterpret_cast<const char*>(&value);
+  out->insert(out->end(), bytes, bytes + sizeof(value));
+}
+
+}  // namespace
+
+void append_game_stream_header(std::vector<char>* out) {
+  append_value(kGameStreamMagic, out);
+  append_value(kGameStreamVersion, out);
+}
+
+void append_game_stream(const GameStream& game, std::vector<char>* out) {
+  append_value(static_cast<uint32_t>(game.game_id), out);
+  append_value(static_cast<uint8_t>(game.result), out);
+  append_value(static_cast<uint16_t>(game.starting_fen.size()), out);
+  out->insert(out->end(), game.starting_fen.begin(), game.starting_fen.end());
+  append_value(static_cast<uint32_t>(game.plies.size()), out);
+  for (const auto& ply : game.plies) {
+    append_value(ply.move, out);
+    append_value(ply.flags, out);
+    append_value(ply.score_cp, out);
+    if (ply.flags & kPlyExtendedScore) append_value(ply.score, out);
+  }
+}
+
+GameStreamReader::GameStreamReader(const char* data, size_t size)
+    : pos_(data), end_(data + size) {
+  uint32_t magic, version;
+  Read(&magic, sizeof(magic));
+  Read(&version, sizeof(version));
+  if (magic != kGameStreamMagic || version != kGameStreamVersion) {
+    throw lczero::Exception("Not a game stream file");
+  }
+}
+
+void GameStreamReader::Read(void* dst, size_t size) {
+  if (static_cast<size_t>(end_ - pos_) < size) {
+    throw lczero::Exception("Truncated game stream");
+  }
+  std::memcpy(dst, pos_, size);
+  pos_ += size;
+}
+
+bool GameStreamReader::Next(GameStream* game) {
+  if (pos_ == end_) return false;
+  uint32_t game_id, ply_count;
+  uint8_t result;
+  uint16_t fen_length;
+  Read(&game_id, sizeof(game_id));
+  Read(&result, sizeof(result));
+  Read(&fen_length, sizeof(fen_length));
+  game->game_id = game_id;
+  game->result = static_cast<lczero::GameResult>(result);
+  game->starting_fen.resize(fen_length);
+  Read(&game->starting_fen[0], fen_length);
+  Read(&ply_count, sizeof(ply_count));
+  game->plies.resize(ply_count);
+  for (auto& ply : game->plies) {
+    Read(&ply.move, sizeof(ply.move));
+    Read(&ply.flags, sizeof(ply.flags));
+    Read(&ply.score_cp, sizeof(ply.score_cp));
+    if (ply.flags & kPlyExtendedScore) {
+      Read(&ply.score, sizeof(ply.score));
+    } else {
+      ply.score = ply.score_cp / 100.0f;
+    }
+  }
+  return true;
+}
+
+void read_game_stream_file(const std::string& filename,
+                           std::vector<char>* data) {
+  read_compressed_file(filename, data);
+}
+
+void expand_game_stream(const GameStream& game, const ScoreToQ& score_to_q,
+                        std::vector<lczero::V4TrainingData>* records,
+                        std::vector<float>* scores) {
+  records->clear();
+  scores->clear();
+  lczero::PositionHistory position_history;
+  reset_position_history(game.starting_fen, &position_history);
+  for (const auto& ply : game.plies) {
+    lczero::Move move = decode_game_stream_move(ply.move);
+    if (!(ply.flags & kPlySkip)) {
+      auto legal_moves =
+          position_history.Last().GetBoard().GenerateLegalMoves();
+      records->push_back(get_v4_training_data(game.result, position_history,
+                                              move, legal_moves, 0.0f));
+      scores->push_back((ply.flags & kPlyHasScore) ? ply.score : 0.0f);
+    }
+    position_history.Append(move);
+  }
+  set_training_data_q(score_to_q, scores, records);
+}
+
+void expand_game_streams(
+    const std::vector<GameStream>& games, const ScoreToQ& score_to_q,
+    int threads,
+    const std::function<void(const GameStream&,
+                             const std::vector<lczero::V4TrainingData>&)>&
+        callback) {
+  std::atomic<size_t> next_game(0);
+  // Games are handed to |callback| in index order, so that a shuffle buffer
+  // behind it sees the same sequence with any number of threads.
+  std::mutex turn_mutex;
+  std::condition_variable turn_changed;
+  size_t turn = 0;
+  auto worker = [&]() {
+    std::vector<lczero::V4TrainingData> records;
+    std::vector<float> scores;
+    for (size_t idx = next_game++; idx < games.size(); idx = next_game++) {
+      expand_game_stream(games[idx], score_to_q, &records, &scores);
+      std::unique_lock<std::mutex> lock(turn_mutex);
+      turn_changed.wait(lock, [&]() { return turn == idx; });
+      callback(games[idx], records);
+      turn++;
+      turn_changed.notify_all();
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; ++i) workers.emplace_back(worker);
+  worker();
+  for (auto& thread : workers) thread.join();
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+// Game stream format: instead of expanded training records, store the
+// starting position, the result and one small entry per ply. Consecutive
+// training records of a game share 7 of their 8 history positions, so
+// regenerating them at training time is far cheaper in storage than keeping
+// them, and the same stream can be expanded again with other options without
+// going back to the PGN.
+//
+// A stream file is gzip compressed and starts with kGameStreamMagic and
+// kGameStreamVersion (uint32 each), followed by games:
+//   uint32 game id
+//   uint8  result (lczero::GameResult)
+//   uint16 length of the starting FEN, then the FEN characters
+//   uint32 number of plies, then for every ply:
+//     uint16 move, uint8 flags, int16 score in centipawns
+//     float  score, only when kPlyExtendedScore is set
+// All values are in host byte order, like lc0 training records.
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "chess/position.h"
+#include "neural/writer.h"
+#include "score_to_q.h"
+
+const uint32_t kGameStreamMagic = 0x53474454;  // "TDGS"
+const uint32_t kGameStreamVersion = 1;
+
+// The ply produces no training record (bad or dubious move NAG).
+const uint8_t kPlySkip = 1;
+// The ply has an engine score, otherwise Q is 0.
+const uint8_t kPlyHasScore = 2;
+// The score doesn't fit in whole centipawns and is stored as a float.
+const uint8_t kPlyExtendedScore = 4;
+
+struct GameStreamPly {
+  // lc0 move from the side to move's point of view, same bit layout as
+  // lczero::Move: to square, from square, promotion, castling flag.
+  uint16_t move = 0;
+  uint8_t flags = 0;
+  int16_t score_cp = 0;
+  // Exact score in pawns, as read from the PGN comment.
+  float score = 0.0f;
+};
+
+struct GameStream {
+  int game_id = 0;
+  lczero::GameResult result = lczero::GameResult::DRAW;
+  std::string starting_fen;
+  std::vector<GameStreamPly> plies;
+};
+
+uint16_t encode_game_stream_move(lczero::Move move);
+lczero::Move decode_game_stream_move(uint16_t move);
+
+// Builds a ply entry, choosing the centipawn or float score encoding.
+GameStreamPly make_game_stream_ply(lczero::Move move, bool skip,
+                                   bool has_score, float score);
+
+// Appends the serialized |game| to |out|. |out| must start with the file
+// header written by append_game_stream_header().
+void append_game_stream_header(std::vector<char>* out);
+void append_game_stream(const GameStream& game, std::vector<char>* out);
+
+// Reads games back from a decompressed stream file.
+class GameStreamReader {
+ public:
+  // Throws when |data| doesn't start with a valid header.
+  GameStreamReader(const char* data, size_t size);
+
+  // Returns false at the end of the data.
+  bool Next(GameStream* game);
+
+ private:
+  void Read(void* dst, size_t size);
+
+  const char* pos_;
+  const char* end_;
+};
+
+// Loads and decompresses a stream file.
+void read_game_stream_file(const std::string& filename,
+                           std::vector<char>* data);
+
+// Regenerates the training records of |game|, exactly as the PGN converter
+// would have produced them with the same |score_to_q|. |scores| is scratch
+// space.
+void expand_game_stream(const GameStream& game, const ScoreToQ& score_to_q,
+                        std::vector<lczero::V4TrainingData>* records,
+                        std::vector<float>* scores);
+
+// Expands |games| on |threads| threads. |callback| is called once per game
+// from the worker threads, one call at a time and in the order of |games|.
+void expand_game_streams(
+    const std::vector<GameStream>& games, const ScoreToQ& score_to_q,
+    int threads,
+    const std::function<void(const GameStream&,
+                             const std::vector<lczero::V4TrainingData>&)>&
+        callback);
@@ -0,0 +1,50 @@
+#include "manifest.h"
+
+#include <cstdio>
+
+#include "utils/exception.h"
+
+namespace {
+
+// Appends |text| to |out| as the contents of a JSON string.
+void append_json_string(const std::string& text, std::string* out) {
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      *out += '\\';
+      *out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      *out += escaped;
+    } else {
+      *out += c;
+    }
+  }
+}
+
+}  // namespace
+
+ManifestWriter::ManifestWriter(const std::string& filename)
+    : file_(std::fopen(filename.c_str(), "w")) {
+  if (!file_) throw lczero::Exception("Cannot create manifest " + filename);
+}
+
+ManifestWriter::~ManifestWriter() { std::fclose(file_); }
+
+void ManifestWriter::Append(const ManifestEntry& entry) {
+  // Paths start with the user's -o directory.
+  line_ = "{\"path\":\"";
+  append_json_string(entry.path, &line_);
+  line_ += "\",\"games\":[";
+  for (size_t i = 0; i < entry.game_ids.size(); ++i) {
+    if (i > 0) line_ += ',';
+    line_ += std::to_string(entry.game_ids[i]);
+  }
+  line_ += "],\"records\":" + std::to_string(entry.records) +
+           ",\"compressed_bytes\":" + std::to_string(entry.compressed_bytes) +
+           ",\"uncompressed_bytes\":" +
+           std::to_string(entry.uncompressed_bytes) +
+           ",\"crc32\":" + std::to_string(entry.crc32) + "}\n";
+  std::fwrite(line_.data(), 1, line_.size(), file_);
+  std::fflush(file_);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Description of one finished output file.
+struct ManifestEntry {
+  std::string path;
+  std::vector<int> game_ids;
+  size_t records = 0;
+  size_t compressed_bytes = 0;
+  size_t uncompressed_bytes = 0;
+  // zlib crc32() of the file as stored on disk.
+  uint32_t crc32 = 0;
+};
+
+// Writes one JSON object per line for every output file, as soon as the file
+// is complete. Lines are flushed immediately, so after a crash the manifest
+// lists exactly the files that were fully written.
+class ManifestWriter {
+ public:
+  explicit ManifestWriter(const std::string& filename);
+  ~ManifestWriter();
+
+  void Append(const ManifestEntry& entry);
+
+ private:
+  FILE* file_;
+  std::string line_;
+};
@@ -0,0 +1,177 @@
+#include "memory_budget.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define HAS_GETRUSAGE
+#endif
+
+struct MemoryPoolStats {
+  std::string name;
+  std::atomic<size_t> used{0};
+  std::atomic<size_t> high_water{0};
+};
+
+namespace {
+
+std::mutex pools_mutex;
+std::vector<std::unique_ptr<MemoryPoolStats>> pools;
+
+}  // namespace
+
+MemoryBudget::MemoryBudget(size_t limit) : limit_(limit) {}
+
+size_t MemoryBudget::used() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return used_;
+}
+
+size_t MemoryBudget::high_water() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return high_water_;
+}
+
+void MemoryBudget::Reserve(size_t bytes, size_t held) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (limit_ > 0 && used_ + bytes > limit_) {
+    blocked_held_ += held;
+    released_cv_.notify_all();
+    released_cv_.wait(lock, [&]() {
+      return used_ + bytes <= limit_ || reserved_ <= blocked_held_;
+    });
+    blocked_held_ -= held;
+  }
+  used_ += bytes;
+  reserved_ += bytes;
+  high_water_ = std::max(high_water_, used_);
+}
+
+void MemoryBudget::Charge(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  used_ += bytes;
+  high_water_ = std::max(high_water_, used_);
+}
+
+void MemoryBudget::Release(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_ -= bytes;
+    reserved_ -= bytes;
+  }
+  released_cv_.notify_all();
+}
+
+void MemoryBudget::Refund(size_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_ -= bytes;
+  }
+  released_cv_.notify_all();
+}
+
+MemoryPool::MemoryPool(const std::string& name, MemoryBudget* budget)
+    : budget_(budget) {
+  std::lock_guard<std::mutex> lock(pools_mutex);
+  for (const auto& pool : pools) {
+    if (pool->name == name) stats_ = pool.get();
+  }
+  if (!stats_) {
+    pools.emplace_back(new MemoryPoolStats);
+    pools.back()->name = name;
+    stats_ = pools.back().get();
+  }
+}
+
+MemoryPool::~MemoryPool() {
+  Release(reserved_);
+  Refund(charged_);
+}
+
+void MemoryPool::Add(size_t bytes) {
+  size_t used = stats_->used += bytes;
+  size_t high_water = stats_->high_water;
+  while (used > high_water &&
+         !stats_->high_water.compare_exchange_weak(high_water, used)) {
+  }
+}
+
+void MemoryPool::Subtract(size_t bytes) { stats_->used -= bytes; }
+
+void MemoryPool::Reserve(size_t bytes, size_t held) {
+  if (bytes == 0) return;
+  if (budget_) budget_->Reserve(bytes, held);
+  reserved_ += bytes;
+  Add(bytes);
+}
+
+void MemoryPool::Charge(size_t bytes) {
+  if (bytes == 0) return;
+  if (budget_) budget_->Charge(bytes);
+  charged_ += bytes;
+  Add(bytes);
+}
+
+void MemoryPool::Release(size_t bytes) {
+  if (bytes == 0) return;
+  if (budget_) budget_->Release(bytes);
+  reserved_ -= bytes;
+  Subtract(bytes);
+}
+
+void MemoryPool::Refund(size_t bytes) {
+  if (bytes == 0) return;
+  if (budget_) budget_->Refund(bytes);
+  charged_ -= bytes;
+  Subtract(bytes);
+}
+
+size_t MemoryPool::used() const { return reserved_ + charged_; }
+
+size_t peak_rss_bytes() {
+#if defined(HAS_GETRUSAGE)
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+  return static_cast<size_t>(usage.ru_maxrss);
+#else
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+void print_memory_report(const MemoryBudget& budget) {
+  const double kMB = 1024.0 * 1024.0;
+  char line[128];
+  std::cout << "Memory:\n";
+  size_t peak_rss = peak_rss_bytes();
+  if (peak_rss > 0) {
+    std::snprintf(line, sizeof(line), "  %-16s %10.1f MB\n", "peak RSS",
+                  peak_rss / kMB);
+  } else {
+    std::snprintf(line, sizeof(line), "  %-16s %10s\n", "peak RSS",
+                  "unknown");
+  }
+  std::cout << line;
+  if (budget.limit() > 0) {
+    std::snprintf(line, sizeof(line), "  %-16s %10.1f MB\n", "budget",
+                  budget.limit() / kMB);
+    std::cout << line;
+  }
+  std::snprintf(line, sizeof(line), "  %-16s %10.1f MB\n", "pools peak",
+                budget.high_water() / kMB);
+  std::cout << line;
+  std::lock_guard<std::mutex> lock(pools_mutex);
+  for (const auto& pool : pools) {
+    std::snprintf(line, sizeof(line), "  %-16s %10.1f MB high water\n",
+                  pool->name.c_str(), pool->high_water / kMB);
+    std::cout << line;
+  }
+  std::cout << std::flush;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+// Accounting of the memory held by buffer pools and caches against one global
+// budget. Every pool draws from the same MemoryBudget; once it is exhausted,
+// producers block in MemoryPool::Reserve() until the consumers they feed
+// release memory, which throttles the conversion instead of growing without
+// bound.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+class MemoryBudget {
+ public:
+  // |limit| in bytes, 0 for no limit. Memory is accounted either way.
+  explicit MemoryBudget(size_t limit = 0);
+
+  size_t limit() const { return limit_; }
+  size_t used() const;
+  size_t high_water() const;
+
+ private:
+  friend class MemoryPool;
+
+  void Reserve(size_t bytes, size_t held);
+  void Charge(size_t bytes);
+  void Release(size_t bytes);
+  void Refund(size_t bytes);
+
+  const size_t limit_;
+  mutable std::mutex mutex_;
+  std::condition_variable released_cv_;
+  size_t used_ = 0;
+  size_t high_water_ = 0;
+  // Bytes taken with Reserve(). They are released once the buffers holding
+  // them have been consumed, so they are worth waiting for.
+  size_t reserved_ = 0;
+  // Bytes held by the threads waiting in Reserve(), which can't be released
+  // until they get what they wait for.
+  size_t blocked_held_ = 0;
+};
+
+struct MemoryPoolStats;
+
+// The memory of one kind of buffer. Pools of the same name share their
+// numbers, which are kept for print_memory_report() after the pool is gone.
+class MemoryPool {
+ public:
+  // |budget| can be null, the pool then only keeps track of its size.
+  MemoryPool(const std::string& name, MemoryBudget* budget);
+  ~MemoryPool();
+
+  // Takes |bytes| from the budget, waiting while it is exhausted and memory
+  // reserved elsewhere is still going to be released. |held| is what the
+  // caller already holds and can't release while it waits. When nothing
+  // else can be released the reservation is granted over the limit rather
+  // than deadlocking.
+  void Reserve(size_t bytes, size_t held = 0);
+  // Takes |bytes| without ever waiting, for long lived buffers and for the
+  // consumers others wait on.
+  void Charge(size_t bytes);
+  // Give back memory taken with Reserve() and Charge() respectively.
+  void Release(size_t bytes);
+  void Refund(size_t bytes);
+
+  size_t used() const;
+
+ private:
+  void Add(size_t bytes);
+  void Subtract(size_t bytes);
+
+  MemoryBudget* budget_;
+  MemoryPoolStats* stats_ = nullptr;
+  std::atomic<size_t> reserved_{0};
+  std::atomic<size_t> charged_{0};
+};
+
+// Peak resident set size of the process in bytes, 0 when unknown.
+size_t peak_rss_bytes();
+
+// Prints peak RSS, the budget and the high-water mark of every pool.
+void print_memory_report(const MemoryBudget& budget);
@@ -0,0 +1,31 @@
+#include "mpmc_queue.h"
+
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+bool queue_backoff(int* spins) {
+  if (++*spins < 64) return true;
+  if (*spins < 128) {
+    std::this_thread::yield();
+    return true;
+  }
+  // Idle for longer, e.g. a -serve daemon between requests.
+  return false;
+}
+
+void print_queue_report(const std::vector<QueueMetrics>& queues) {
+  char line[160];
+  std::cout << "Queues:\n";
+  for (const auto& queue : queues) {
+    std::snprintf(line, sizeof(line),
+                  "  %-16s %6.1f of %zu mean, %zu high water, %llu full, "
+                  "%llu empty waits\n",
+                  queue.name.c_str(), queue.mean_occupancy, queue.capacity,
+                  queue.high_water,
+                  static_cast<unsigned long long>(queue.push_waits),
+                  static_cast<unsigned long long>(queue.pop_waits));
+    std::cout << line;
+  }
+  std::cout << std::flush;
+}
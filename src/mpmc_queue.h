@@ -0,0 +1,289 @@
+#pragma once
+
+// Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's
+// ring buffer) for handing pooled buffers from one pipeline stage to the
+// next without a mutex.
+//
+// Every cell carries a sequence number: it equals the cell's position while
+// the cell is free for a producer, the position + 1 once a value is stored,
+// and it advances by the capacity when a consumer takes the value. Producers
+// and consumers claim positions with a compare-and-swap on their own
+// counter, so they only contend with their own kind, and a batch of
+// consecutive positions is claimed with a single compare-and-swap.
+//
+// A side that finds the queue full or empty spins and yields for a moment,
+// then sleeps on a condition variable. The other side only takes the mutex
+// to wake it when a sleeper has registered, which costs a fence and a load
+// per batch while nobody sleeps.
+//
+// Every queue keeps occupancy metrics: the high-water mark, the mean
+// occupancy seen by consumers and how often either side had to wait. A
+// queue that is mostly full points at a slow consumer stage, one that is
+// mostly empty at a slow producer.
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+struct QueueMetrics {
+  std::string name;
+  size_t capacity = 0;
+  size_t high_water = 0;
+  // Values waiting in the queue, averaged over all pops.
+  double mean_occupancy = 0;
+  // Pushes that found the queue full, pops that found it empty.
+  uint64_t push_waits = 0;
+  uint64_t pop_waits = 0;
+};
+
+// Prints one line per queue.
+void print_queue_report(const std::vector<QueueMetrics>& queues);
+
+// Spins briefly, then yields. Returns false once the caller should block
+// instead.
+bool queue_backoff(int* spins);
+
+template <typename T>
+class MpmcQueue {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Queues carry pointers or other trivially copyable values");
+
+ public:
+  // Room for |capacity| values, rounded up to a power of two.
+  MpmcQueue(const std::string& name, size_t capacity) : name_(name) {
+    size_t size = 2;
+    while (size < capacity) size <<= 1;
+    mask_ = size - 1;
+    cells_.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) cells_[i].sequence = i;
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+  // Values in the queue, exact only while nobody pushes or pops.
+  size_t size() const {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  // Stores up to |count| values from |values| and returns how many, 0 when
+  // the queue is full.
+  size_t TryPushBatch(const T* values, size_t count) {
+    if (count == 0) return 0;
+    size_t position = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      size_t free = 0;
+      while (free < count && free <= mask_ &&
+             cells_[(position + free) & mask_].sequence.load(
+                 std::memory_order_acquire) == position + free) {
+        free++;
+      }
+      if (free == 0) {
+        // Full, or another producer moved on: retry only in the latter
+        // case.
+        size_t sequence =
+            cells_[position & mask_].sequence.load(std::memory_order_acquire);
+        if (static_cast<std::ptrdiff_t>(sequence - position) < 0) return 0;
+        position = tail_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (tail_.compare_exchange_weak(position, position + free,
+                                      std::memory_order_relaxed)) {
+        for (size_t i = 0; i < free; ++i) {
+          Cell& cell = cells_[(position + i) & mask_];
+          cell.value = values[i];
+          cell.sequence.store(position + i + 1, std::memory_order_release);
+        }
+        UpdateHighWater(position + free);
+        return free;
+      }
+    }
+  }
+
+  // Takes up to |count| values into |values| and returns how many, 0 when
+  // the queue is empty.
+  size_t TryPopBatch(T* values, size_t count) {
+    if (count == 0) return 0;
+    size_t position = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      size_t ready = 0;
+      while (ready < count && ready <= mask_ &&
+             cells_[(position + ready) & mask_].sequence.load(
+                 std::memory_order_acquire) == position + ready + 1) {
+        ready++;
+      }
+      if (ready == 0) {
+        size_t sequence =
+            cells_[position & mask_].sequence.load(std::memory_order_acquire);
+        if (static_cast<std::ptrdiff_t>(sequence - (position + 1)) < 0) {
+          return 0;
+        }
+        position = head_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (head_.compare_exchange_weak(position, position + ready,
+                                      std::memory_order_relaxed)) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        occupancy_sum_.fetch_add(tail > position ? tail - position : ready,
+                                 std::memory_order_relaxed);
+        pops_.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < ready; ++i) {
+          Cell& cell = cells_[(position + i) & mask_];
+          values[i] = cell.value;
+          cell.sequence.store(position + i + mask_ + 1,
+                              std::memory_order_release);
+        }
+        return ready;
+      }
+    }
+  }
+
+  bool TryPush(const T& value) { return TryPushBatch(&value, 1) == 1; }
+  bool TryPop(T* value) { return TryPopBatch(value, 1) == 1; }
+
+  // Stores all |count| values, waiting while the queue is full.
+  void PushBatch(const T* values, size_t count) {
+    int spins = 0;
+    bool waited = false;
+    while (count > 0) {
+      size_t pushed = TryPushBatch(values, count);
+      if (pushed > 0) {
+        values += pushed;
+        count -= pushed;
+        Wake(&pop_sleepers_, &not_empty_);
+        continue;
+      }
+      if (!waited) push_waits_.fetch_add(1, std::memory_order_relaxed);
+      waited = true;
+      if (!queue_backoff(&spins)) {
+        Sleep(&push_sleepers_, &not_full_, [this]() { return !Full(); });
+      }
+    }
+  }
+  void Push(const T& value) { PushBatch(&value, 1); }
+
+  // Takes between 1 and |count| values, waiting while the queue is empty.
+  // Returns 0 once the queue is closed and empty.
+  size_t PopBatch(T* values, size_t count) {
+    int spins = 0;
+    bool waited = false;
+    for (;;) {
+      // Read before trying, so that a value pushed before Close() is seen.
+      bool closed = closed_.load(std::memory_order_acquire);
+      size_t popped = TryPopBatch(values, count);
+      if (popped > 0) Wake(&push_sleepers_, &not_full_);
+      if (popped > 0 || closed) return popped;
+      if (!waited) pop_waits_.fetch_add(1, std::memory_order_relaxed);
+      waited = true;
+      if (!queue_backoff(&spins)) {
+        Sleep(&pop_sleepers_, &not_empty_, [this]() {
+          return !Empty() || closed_.load(std::memory_order_acquire);
+        });
+      }
+    }
+  }
+  bool Pop(T* value) { return PopBatch(value, 1) == 1; }
+
+  // No more values follow, consumers drain the queue and stop.
+  void Close() {
+    closed_.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    not_empty_.notify_all();
+    not_full_.notify_all();
+  }
+
+  QueueMetrics metrics() const {
+    QueueMetrics metrics;
+    metrics.name = name_;
+    metrics.capacity = capacity();
+    metrics.high_water = high_water_.load(std::memory_order_relaxed);
+    uint64_t pops = pops_.load(std::memory_order_relaxed);
+    if (pops > 0) {
+      metrics.mean_occupancy =
+          static_cast<double>(occupancy_sum_.load(std::memory_order_relaxed)) /
+          pops;
+    }
+    metrics.push_waits = push_waits_.load(std::memory_order_relaxed);
+    metrics.pop_waits = pop_waits_.load(std::memory_order_relaxed);
+    return metrics;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  // Whether the next push or pop would find no cell, as in TryPushBatch()
+  // and TryPopBatch().
+  bool Full() const {
+    size_t position = tail_.load(std::memory_order_relaxed);
+    size_t sequence =
+        cells_[position & mask_].sequence.load(std::memory_order_acquire);
+    return static_cast<std::ptrdiff_t>(sequence - position) < 0;
+  }
+  bool Empty() const {
+    size_t position = head_.load(std::memory_order_relaxed);
+    size_t sequence =
+        cells_[position & mask_].sequence.load(std::memory_order_acquire);
+    return static_cast<std::ptrdiff_t>(sequence - (position + 1)) < 0;
+  }
+
+  // Sleeps until |ready| or a wake up. The sleeper registers before checking
+  // |ready|, and the other side publishes before checking for sleepers, so
+  // at least one of them sees the other.
+  template <typename Ready>
+  void Sleep(std::atomic<int>* sleepers, std::condition_variable* wakeup,
+             Ready ready) {
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    sleepers->fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!ready()) wakeup->wait(lock);
+    sleepers->fetch_sub(1, std::memory_order_relaxed);
+  }
+  void Wake(std::atomic<int>* sleepers, std::condition_variable* wakeup) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers->load(std::memory_order_relaxed) == 0) return;
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    wakeup->notify_all();
+  }
+
+  void UpdateHighWater(size_t tail) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t size = tail > head ? tail - head : 0;
+    size_t high_water = high_water_.load(std::memory_order_relaxed);
+    while (size > high_water &&
+           !high_water_.compare_exchange_weak(high_water, size,
+                                              std::memory_order_relaxed)) {
+    }
+  }
+
+  const std::string name_;
+  size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+  // Producers and consumers each get their own cache line.
+  char padding_tail_[64];
+  std::atomic<size_t> tail_{0};
+  char padding_head_[64];
+  std::atomic<size_t> head_{0};
+  char padding_metrics_[64];
+  std::atomic<bool> closed_{false};
+  std::atomic<size_t> high_water_{0};
+  std::atomic<uint64_t> occupancy_sum_{0};
+  std::atomic<uint64_t> pops_{0};
+  std::atomic<uint64_t> push_waits_{0};
+  std::atomic<uint64_t> pop_waits_{0};
+  // Producers and consumers that gave up spinning.
+  std::mutex sleep_mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::atomic<int> push_sleepers_{0};
+  std::atomic<int> pop_sleepers_{0};
+};
@@ -0,0 +1,500 @@
+#include "multi_process.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <map>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "memory_budget.h"
+#include "polyglot_lib.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+
+namespace {
+
+// A converted range is done once its games are written out: right after its
+// conversion, when the worker flushes its writer, or only when the writer
+// has finished if a shuffle buffer mixes it with other ranges. A range is
+// pending again when the parent gives it back after its worker crashed.
+enum RangeState { kRangePending, kRangeClaimed, kRangeConverted, kRangeDone };
+
+// Whether a writer with |options| holds records of any range back until it
+// finishes, mixed with those of other ranges.
+bool shuffles_records(const WriterOptions& options) {
+  return options.shuffle_buffer_size > 0 &&
+         options.format != OutputFormat::GAME_STREAM;
+}
+
+}  // namespace
+
+struct WorkRange : GameRange {
+  std::atomic<int> state{kRangePending};
+  // Process that claimed the range.
+  std::atomic<int> worker{0};
+  // Times the range was given back after a crash.
+  std::atomic<int> requeued{0};
+};
+
+// Lives in memory shared by the parent and all workers, followed by the
+// WorkRanges. Everything in it is an atomic that is lock free and thus
+// works across processes.
+struct SharedWorkQueue {
+  std::atomic<size_t> next_range{0};
+  size_t range_count = 0;
+  std::atomic<int> file_ids{0};
+  ConversionStats stats;
+
+  WorkRange* ranges() { return reinterpret_cast<WorkRange*>(this + 1); }
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "The work queue needs lock free atomics");
+
+void read_range(const std::string& filename, uint64_t begin, uint64_t end,
+                std::vector<char>* text) {
+  std::ifstream file(filename, std::ios::binary);
+  text->resize(end - begin);
+  file.seekg(begin);
+  file.read(text->data(), text->size());
+  if (!file) throw lczero::Exception("Cannot read " + filename);
+}
+
+void convert_range(const std::vector<char>& text, int first_game_id,
+                   int games, const Options& options,
+                   const ScoreToQ& score_to_q,
+                   AsyncTrainingDataWriter* writer, ConversionStats* stats) {
+  pgn_t pgn[1];
+  if (!pgn_open_memory(pgn, text.data(), text.size())) return;
+  int game_id = first_game_id;
+  try {
+    while (game_id < first_game_id + games && next_game(pgn)) {
+      write_one_game_training_data(pgn, game_id++, options, score_to_q,
+                                   writer, stats);
+    }
+  } catch (const PolyglotError& e) {
+    std::cout << "PGN error in games " << first_game_id << "-"
+              << first_game_id + games - 1 << ": " << e.what()
+              << ", skipping the rest of them" << '\n';
+  }
+  pgn_close(pgn);
+}
+
+namespace {
+
+std::string worker_manifest_filename(const std::string& manifest, int pid) {
+  return manifest + ".worker-" + std::to_string(pid);
+}
+
+// One ring per slot, a replacement continues the ring of the worker it
+// replaces.
+std::string worker_ring_name(const std::string& ring, int slot) {
+  return ring + "." + std::to_string(slot);
+}
+
+// Closes the ring of a slot that no worker will close, one that died without
+// a replacement or never started, so that its consumers see the end of the
+// stream instead of waiting forever. Creates the ring if it doesn't exist.
+void close_worker_ring(const WriterOptions& writer_options, int slot) {
+  if (writer_options.shm_ring_name.empty()) return;
+  ShmRingProducer ring(worker_ring_name(writer_options.shm_ring_name, slot),
+                       writer_options.shm_ring_records);
+  ring.Close();
+}
+
+// Appends the worker's manifest to |manifest| and removes it.
+void merge_manifest(const std::string& filename, FILE* manifest) {
+  FILE* file = std::fopen(filename.c_str(), "rb");
+  if (!file) return;
+  char buffer[1 << 16];
+  size_t bytes;
+  while ((bytes = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    std::fwrite(buffer, 1, bytes, manifest);
+  }
+  std::fclose(file);
+  std::fflush(manifest);
+  std::remove(filename.c_str());
+}
+
+}  // namespace
+
+namespace {
+
+// index_pgn_games(), also counting the games in |*games_found|. |offsets|
+// may be null.
+uint64_t scan_pgn_games(const std::string& filename, size_t max_games,
+                        std::vector<uint64_t>* offsets, size_t* games_found) {
+  FILE* file = std::fopen(filename.c_str(), "rb");
+  if (!file) throw lczero::Exception("Cannot open " + filename);
+  std::vector<char> buffer(1 << 20);
+  uint64_t offset = 0;
+  size_t games = 0;
+  bool line_start = true;
+  // Rest of the line is skipped: a tag or a ';' comment.
+  bool skip_line = false;
+  bool in_comment = false;
+  // The last line that wasn't blank or a comment was a tag.
+  bool in_tags = false;
+  size_t bytes;
+  while ((bytes = std::fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+    for (size_t i = 0; i < bytes; ++i, ++offset) {
+      char c = buffer[i];
+      if (c == '\n') {
+        line_start = true;
+        skip_line = false;
+        continue;
+      }
+      if (skip_line) continue;
+      if (in_comment) {
+        if (c == '}') in_comment = false;
+        continue;
+      }
+      bool first = line_start;
+      line_start = false;
+      if (c == ' ' || c == '\t' || c == '\r') {
+        line_start = first;
+        continue;
+      }
+      if (first && c == '[') {
+        if (!in_tags) {
+          if (games == max_games) {
+            std::fclose(file);
+            *games_found = games;
+            return offset;
+          }
+          if (offsets) offsets->push_back(games == 0 ? 0 : offset);
+          games++;
+          in_tags = true;
+        }
+        skip_line = true;
+      } else if (c == '{') {
+        in_comment = true;
+      } else if (c == ';') {
+        skip_line = true;
+      } else {
+        in_tags = false;
+      }
+    }
+  }
+  std::fclose(file);
+  *games_found = games;
+  return offset;
+}
+
+}  // namespace
+
+uint64_t index_pgn_games(const std::string& filename, size_t max_games,
+                         std::vector<uint64_t>* offsets) {
+  size_t games;
+  return scan_pgn_games(filename, max_games, offsets, &games);
+}
+
+size_t count_pgn_games(const std::string& filename, size_t max_games) {
+  size_t games;
+  scan_pgn_games(filename, max_games, nullptr, &games);
+  return games;
+}
+
+size_t split_pgn_games(const std::vector<std::string>& input_files,
+                       size_t max_games, size_t games_per_range,
+                       std::vector<GameRange>* ranges) {
+  size_t total_games = 0;
+  for (size_t file = 0; file < input_files.size() && total_games < max_games;
+       ++file) {
+    std::vector<uint64_t> offsets;
+    uint64_t end =
+        index_pgn_games(input_files[file], max_games - total_games, &offsets);
+    for (size_t i = 0; i < offsets.size(); i += games_per_range) {
+      size_t games = std::min(games_per_range, offsets.size() - i);
+      ranges->emplace_back();
+      GameRange& range = ranges->back();
+      range.file = static_cast<int>(file);
+      range.first_game_id = static_cast<int>(total_games + i);
+      range.games = static_cast<int>(games);
+      range.begin = offsets[i];
+      range.end = i + games < offsets.size() ? offsets[i + games] : end;
+    }
+    total_games += offsets.size();
+  }
+  return total_games;
+}
+
+MultiProcessConverter::MultiProcessConverter(
+    const std::vector<std::string>& input_files, size_t max_games,
+    size_t games_per_range)
+    : input_files_(input_files) {
+  std::vector<GameRange> ranges;
+  games_ = split_pgn_games(input_files_, max_games, games_per_range, &ranges);
+
+#if !defined(_WIN32)
+  queue_bytes_ = sizeof(SharedWorkQueue) + ranges.size() * sizeof(WorkRange);
+  void* memory = mmap(nullptr, queue_bytes_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    throw lczero::Exception(std::string("Cannot map the work queue: ") +
+                            std::strerror(errno));
+  }
+  queue_ = new (memory) SharedWorkQueue;
+  queue_->range_count = ranges.size();
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    WorkRange* range = new (&queue_->ranges()[i]) WorkRange;
+    static_cast<GameRange&>(*range) = ranges[i];
+  }
+#endif
+}
+
+MultiProcessConverter::~MultiProcessConverter() {
+#if !defined(_WIN32)
+  if (queue_) munmap(queue_, queue_bytes_);
+#endif
+}
+
+const ConversionStats& MultiProcessConverter::stats() const {
+  return queue_->stats;
+}
+
+size_t MultiProcessConverter::ranges() const { return queue_->range_count; }
+
+size_t MultiProcessConverter::Run(int processes, const Options& options,
+                                  const WriterOptions& writer_options,
+                                  ProgressReporter* progress) {
+#if defined(_WIN32)
+  (void)processes;
+  (void)options;
+  (void)writer_options;
+  (void)progress;
+  throw lczero::Exception("-procs needs fork(), which Windows doesn't have");
+#else
+  size_t memory_budget_bytes =
+      writer_options.memory_budget
+          ? writer_options.memory_budget->limit() / processes
+          : 0;
+  FILE* manifest = nullptr;
+  if (!writer_options.manifest_filename.empty()) {
+    manifest = std::fopen(writer_options.manifest_filename.c_str(), "w");
+    if (!manifest) {
+      throw lczero::Exception("Cannot create manifest " +
+                              writer_options.manifest_filename);
+    }
+  }
+
+  // Slot of every running worker, a replacement takes over the slot.
+  std::map<int, int> workers;
+  for (int i = 0; i < processes; ++i) {
+    if (static_cast<size_t>(i) >= ranges()) {
+      close_worker_ring(writer_options, i);
+      continue;
+    }
+    workers[SpawnWorker(i, options, writer_options, memory_budget_bytes,
+                        progress)] = i;
+  }
+  while (!workers.empty()) {
+    int status;
+    int pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      if (errno == EINTR) continue;
+      throw lczero::Exception(std::string("waitpid failed: ") +
+                              std::strerror(errno));
+    }
+    auto worker = workers.find(pid);
+    if (worker == workers.end()) continue;
+    int slot = worker->second;
+    workers.erase(worker);
+    if (manifest) {
+      merge_manifest(
+          worker_manifest_filename(writer_options.manifest_filename, pid),
+          manifest);
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) continue;
+
+    size_t claimed = ClaimedRanges(pid);
+    size_t requeued = RequeueRanges(pid, writer_options);
+    std::cout << "Worker " << pid << " ";
+    if (WIFSIGNALED(status)) {
+      std::cout << "killed by signal " << WTERMSIG(status) << " ("
+                << strsignal(WTERMSIG(status)) << ")";
+    } else {
+      std::cout << "exited with status " << WEXITSTATUS(status);
+    }
+    std::cout << " with " << claimed << " range(s) not written out, "
+              << requeued << " of them queued again" << std::endl;
+    // A worker that fails before claiming anything would fail again.
+    if (claimed > 0 && HasPendingRanges()) {
+      workers[SpawnWorker(slot, options, writer_options, memory_budget_bytes,
+                          progress)] = slot;
+    } else {
+      close_worker_ring(writer_options, slot);
+    }
+  }
+  if (manifest) std::fclose(manifest);
+
+  size_t lost = 0;
+  for (size_t i = 0; i < ranges(); ++i) {
+    const WorkRange& range = queue_->ranges()[i];
+    if (range.state == kRangeDone) continue;
+    lost++;
+    std::cout << "Lost games " << range.first_game_id << "-"
+              << range.first_game_id + range.games - 1 << " of \'"
+              << input_files_[range.file] << "\' (bytes " << range.begin
+              << "-" << range.end << ")" << '\n';
+  }
+  struct rusage usage;
+  if (getrusage(RUSAGE_CHILDREN, &usage) == 0) {
+    // ru_maxrss is in kilobytes on Linux.
+    std::cout << "Largest worker peak RSS: " << (usage.ru_maxrss >> 10)
+              << " MB" << '\n';
+  }
+  std::cout << std::flush;
+  return lost;
+#endif
+}
+
+#if !defined(_WIN32)
+
+int MultiProcessConverter::SpawnWorker(int slot, const Options& options,
+                                       const WriterOptions& writer_options,
+                                       size_t memory_budget_bytes,
+                                       ProgressReporter* progress) {
+  // The child must not inherit a lock held by the reporter thread, which
+  // doesn't exist there.
+  std::unique_lock<std::mutex> pause;
+  if (progress) pause = progress->Pause();
+  std::cout << std::flush;
+  int pid = fork();
+  if (pid < 0) {
+    throw lczero::Exception(std::string("fork failed: ") +
+                            std::strerror(errno));
+  }
+  if (pid > 0) return pid;
+
+  // The child shares nothing but the queue with the parent. It leaves with
+  // _exit() as the parent's objects and threads are not its own.
+  int status = 0;
+  try {
+    RunWorker(slot, options, writer_options, memory_budget_bytes);
+  } catch (const std::exception& e) {
+    std::cout << "Worker " << getpid() << ": " << e.what() << '\n';
+    status = 1;
+  }
+  std::cout << std::flush;
+  _exit(status);
+}
+
+void MultiProcessConverter::RunWorker(int slot, const Options& options,
+                                      const WriterOptions& writer_options,
+                                      size_t memory_budget_bytes) {
+  ConversionStats* stats = &queue_->stats;
+  MemoryBudget memory_budget(memory_budget_bytes);
+  WriterOptions worker_options = writer_options;
+  worker_options.stats = stats;
+  worker_options.memory_budget = &memory_budget;
+  worker_options.shared_file_ids = &queue_->file_ids;
+  if (!worker_options.manifest_filename.empty()) {
+    worker_options.manifest_filename =
+        worker_manifest_filename(writer_options.manifest_filename, getpid());
+  }
+  if (!worker_options.shm_ring_name.empty()) {
+    worker_options.shm_ring_name =
+        worker_ring_name(writer_options.shm_ring_name, slot);
+  }
+  ScoreToQ score_to_q(logistic_score_model(options.score_scale));
+  AsyncTrainingDataWriter writer(worker_options);
+  bool shuffled = shuffles_records(worker_options);
+  std::vector<char> text;
+  std::vector<size_t> converted;
+  size_t index;
+  while ((index = ClaimRange()) < ranges()) {
+    WorkRange& range = queue_->ranges()[index];
+    read_range(input_files_[range.file], range.begin, range.end, &text);
+    convert_range(text, range.first_game_id, range.games, options, score_to_q,
+                  &writer, stats);
+    stats->input_bytes += range.end - range.begin;
+    range.state = kRangeConverted;
+    if (shuffled) {
+      converted.push_back(index);
+      continue;
+    }
+    // Done as soon as its games are written, a crash later doesn't lose it.
+    writer.Flush();
+    range.state = kRangeDone;
+  }
+  writer.Finish();
+  for (size_t done : converted) queue_->ranges()[done].state = kRangeDone;
+}
+
+size_t MultiProcessConverter::ClaimRange() {
+  // Ranges are claimed through their state, so that none is taken twice,
+  // whether the counter handed it out or a crash gave it back.
+  auto claim = [this](size_t index) {
+    WorkRange& range = queue_->ranges()[index];
+    int pending = kRangePending;
+    if (!range.state.compare_exchange_strong(pending, kRangeClaimed)) {
+      return false;
+    }
+    range.worker = getpid();
+    return true;
+  };
+  for (;;) {
+    size_t index = queue_->next_range++;
+    if (index >= ranges()) break;
+    if (claim(index)) return index;
+  }
+  // Ranges given back by crashed workers.
+  for (size_t index = 0; index < ranges(); ++index) {
+    if (claim(index)) return index;
+  }
+  return ranges();
+}
+
+size_t MultiProcessConverter::ClaimedRanges(int pid) {
+  size_t claimed = 0;
+  for (size_t i = 0; i < ranges(); ++i) {
+    const WorkRange& range = queue_->ranges()[i];
+    if (range.worker == pid && range.state != kRangeDone) claimed++;
+  }
+  return claimed;
+}
+
+size_t MultiProcessConverter::RequeueRanges(
+    int pid, const WriterOptions& writer_options) {
+  // Ranges mixed into a shuffle buffer may be partly written already.
+  if (shuffles_records(writer_options)) return 0;
+  size_t requeued = 0;
+  for (size_t i = 0; i < ranges(); ++i) {
+    WorkRange& range = queue_->ranges()[i];
+    // Only ranges whose games all converted, the one being converted at the
+    // crash may well hold the game that caused it. A range that failed to
+    // be written once is lost rather than retried forever. The flush of a
+    // range cut short may have written some of its games: files named after
+    // their game are written again in place, game stream parts hold those
+    // games twice.
+    if (range.worker != pid || range.state != kRangeConverted ||
+        range.requeued > 0) {
+      continue;
+    }
+    range.requeued++;
+    range.worker = 0;
+    range.state = kRangePending;
+    requeued++;
+  }
+  return requeued;
+}
+
+bool MultiProcessConverter::HasPendingRanges() {
+  for (size_t i = 0; i < ranges(); ++i) {
+    if (queue_->ranges()[i].state == kRangePending) return true;
+  }
+  return false;
+}
+
+#endif
@@ -0,0 +1,106 @@
+#pragma once
+
+// Conversion in forked worker processes (-procs). polyglot and lc0 keep
+// process wide state, processes keep it apart and a worker that crashes on a
+// pathological game only takes the range it was converting down with it,
+// which is reported as lost. Workers write every range out before taking the
+// next one; ranges converted but not yet written out are queued again.
+//
+// The parent splits the input files into ranges of games at game boundaries
+// and puts them in a queue in shared memory, workers claim ranges from it
+// with an atomic increment until it is empty. Games are numbered by their
+// position in the input, so the game ids of a run don't depend on the number
+// of processes or on which games fail.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "async_writer.h"
+#include "pgn_converter.h"
+#include "stats.h"
+
+// Games per work queue entry.
+const size_t kGamesPerRange = 256;
+
+// Appends the byte offset where every game of |filename| starts to
+// |offsets|, up to |max_games| games, and returns where the last of them
+// ends. Games start with their tag section; text before the first one
+// belongs to it.
+uint64_t index_pgn_games(const std::string& filename, size_t max_games,
+                         std::vector<uint64_t>* offsets);
+// Number of games index_pgn_games() finds, without keeping the offsets.
+size_t count_pgn_games(const std::string& filename, size_t max_games);
+
+// |games| consecutive games of an input file, bytes [begin, end) of it.
+struct GameRange {
+  int file;
+  int first_game_id;
+  int games;
+  uint64_t begin;
+  uint64_t end;
+};
+
+// Splits |input_files| into ranges of up to |games_per_range| games, at
+// most |max_games| games in total, numbered by their position in the input.
+// Returns the number of games.
+size_t split_pgn_games(const std::vector<std::string>& input_files,
+                       size_t max_games, size_t games_per_range,
+                       std::vector<GameRange>* ranges);
+
+// Reads bytes [begin, end) of |filename| into |text|.
+void read_range(const std::string& filename, uint64_t begin, uint64_t end,
+                std::vector<char>* text);
+// Converts the |games| games at the start of |text|, numbered from
+// |first_game_id|. A PGN syntax error loses the rest of them.
+void convert_range(const std::vector<char>& text, int first_game_id,
+                   int games, const Options& options,
+                   const ScoreToQ& score_to_q,
+                   AsyncTrainingDataWriter* writer, ConversionStats* stats);
+
+struct SharedWorkQueue;
+
+class MultiProcessConverter {
+ public:
+  // Indexes |input_files|, at most |max_games| games in total.
+  MultiProcessConverter(const std::vector<std::string>& input_files,
+                        size_t max_games,
+                        size_t games_per_range = kGamesPerRange);
+  ~MultiProcessConverter();
+
+  // Counters of all workers together, in shared memory.
+  const ConversionStats& stats() const;
+  size_t games() const { return games_; }
+  size_t ranges() const;
+
+  // Converts everything in |processes| workers, replacing the ones that die
+  // while there is work left. The manifests of the workers are merged into
+  // writer_options.manifest_filename, the memory budget is split evenly
+  // between them. Returns the number of ranges lost to crashed workers.
+  size_t Run(int processes, const Options& options,
+             const WriterOptions& writer_options, ProgressReporter* progress);
+
+ private:
+  // |slot| numbers the workers from 0 to processes - 1.
+  int SpawnWorker(int slot, const Options& options,
+                  const WriterOptions& writer_options,
+                  size_t memory_budget_bytes, ProgressReporter* progress);
+  void RunWorker(int slot, const Options& options,
+                 const WriterOptions& writer_options,
+                 size_t memory_budget_bytes);
+  // Takes the next range of the queue, or one given back after a crash.
+  // Returns ranges() when there is none left.
+  size_t ClaimRange();
+  // Ranges |pid| claimed whose output it didn't finish writing.
+  size_t ClaimedRanges(int pid);
+  // Gives the ranges the crashed worker |pid| converted but didn't write out
+  // back to the queue, and returns their number.
+  size_t RequeueRanges(int pid, const WriterOptions& writer_options);
+  bool HasPendingRanges();
+
+  const std::vector<std::string> input_files_;
+  size_t games_ = 0;
+  SharedWorkQueue* queue_ = nullptr;
+  size_t queue_bytes_ = 0;
+};
@@ -0,0 +1,107 @@
+#include "parallel_files.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "multi_process.h"
+#include "utils/filesystem.h"
+
+namespace {
+
+struct FileJob {
+  std::string filename;
+  uint64_t bytes;
+  // Ids of the file in PER_FILE_RANGES mode.
+  int first_game_id;
+  int end_game_id;
+  // Whether the file was counted to its end, not only up to the games left
+  // under max_games.
+  bool counted_to_end;
+};
+
+}  // namespace
+
+int convert_pgn_files_parallel(const std::vector<std::string>& input_files,
+                               int threads, GameIdMode id_mode,
+                               const Options& options,
+                               const ScoreToQ& score_to_q,
+                               AsyncTrainingDataWriter* writer,
+                               ConversionStats* stats, int first_game_id,
+                               size_t max_games) {
+  std::vector<FileJob> jobs;
+  max_games = std::min<size_t>(max_games, INT_MAX - first_game_id);
+  int end_game_id = first_game_id + static_cast<int>(max_games);
+  if (id_mode == GameIdMode::PER_FILE_RANGES) {
+    int game_id = first_game_id;
+    for (const auto& file : input_files) {
+      size_t games_left = end_game_id - game_id;
+      size_t games = count_pgn_games(file, games_left);
+      if (games == 0) continue;
+      jobs.push_back({file, lczero::GetFileSize(file), game_id,
+                      game_id + static_cast<int>(games), games < games_left});
+      game_id += games;
+    }
+    end_game_id = game_id;
+    if (options.verbose) {
+      std::cout << "Indexed " << end_game_id - first_game_id << " games in "
+                << jobs.size() << " files" << std::endl;
+    }
+  } else {
+    for (const auto& file : input_files) {
+      jobs.push_back({file, lczero::GetFileSize(file), 0, 0, false});
+    }
+  }
+  std::stable_sort(jobs.begin(), jobs.end(),
+                   [](const FileJob& a, const FileJob& b) {
+                     return a.bytes > b.bytes;
+                   });
+
+  std::atomic<size_t> next_job{0};
+  std::atomic<int> shared_game_id{first_game_id};
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto reader = [&]() {
+    try {
+      size_t job;
+      while ((job = next_job++) < jobs.size()) {
+        if (id_mode == GameIdMode::PER_FILE_RANGES) {
+          std::atomic<int> next_game_id{jobs[job].first_game_id};
+          bool games_left = convert_pgn_file_ids(
+              jobs[job].filename, options, score_to_q, writer, stats,
+              &next_game_id, jobs[job].end_game_id);
+          // The quick count and polyglot disagree about where games start,
+          // the ids after the file belong to the next one.
+          if (games_left && jobs[job].counted_to_end) {
+            std::cout << "Warning: \'" << jobs[job].filename
+                      << "\' holds more games than the "
+                      << jobs[job].end_game_id - jobs[job].first_game_id
+                      << " counted, the rest of it was skipped" << std::endl;
+          }
+        } else {
+          convert_pgn_file_ids(jobs[job].filename, options, score_to_q, writer,
+                               stats, &shared_game_id, end_game_id);
+        }
+      }
+    } catch (...) {
+      // The other readers finish their files, the first error is rethrown.
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error) error = std::current_exception();
+      next_job = jobs.size();
+    }
+  };
+  std::vector<std::thread> readers;
+  int reader_count = std::min<int>(std::max(threads, 1), jobs.size());
+  for (int i = 0; i < reader_count; ++i) readers.emplace_back(reader);
+  for (auto& thread : readers) thread.join();
+  if (error) std::rethrow_exception(error);
+
+  if (id_mode == GameIdMode::SHARED_COUNTER) {
+    return std::min(shared_game_id.load(), end_game_id);
+  }
+  return end_game_id;
+}
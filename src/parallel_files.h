@@ -0,0 +1,39 @@
+#pragma once
+
+// Conversion of several input files at once on threads of one process
+// (-parallel-files). Every file gets its own PGN reader, all of them feed
+// the same writer. Threads take the largest remaining file first, so a
+// month of games doesn't start last and hold up the end of the run while
+// small files no longer wait behind it.
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "async_writer.h"
+#include "pgn_converter.h"
+#include "score_to_q.h"
+#include "stats.h"
+
+enum class GameIdMode {
+  // Every file is numbered from a contiguous range that starts after the
+  // games of the files before it on the command line, as counted by
+  // count_pgn_games(). Ids don't depend on the number of threads or on
+  // timing, at the cost of a pass over the input before converting.
+  PER_FILE_RANGES,
+  // Readers take ids from a shared counter as they reach the games. No
+  // indexing pass, but the ids depend on the interleaving of the readers.
+  SHARED_COUNTER,
+};
+
+// Converts |input_files| on |threads| threads and returns the next free
+// game id. Games are numbered from |first_game_id| on by their position in
+// the input, rejected games leave gaps, and at most |max_games| input games
+// are converted across all files.
+int convert_pgn_files_parallel(const std::vector<std::string>& input_files,
+                               int threads, GameIdMode id_mode,
+                               const Options& options,
+                               const ScoreToQ& score_to_q,
+                               AsyncTrainingDataWriter* writer,
+                               ConversionStats* stats, int first_game_id,
+                               size_t max_games);
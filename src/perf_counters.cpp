@@ -0,0 +1,197 @@
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define HAS_PERF_EVENT
+#endif
+
+namespace {
+
+#if defined(HAS_PERF_EVENT)
+
+const uint64_t kCounterConfigs[kPerfCounterCount] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_MISSES,
+};
+
+int open_counter(int counter, bool inherit, int group_fd) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = kCounterConfigs[counter];
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.inherit = inherit ? 1 : 0;
+  if (inherit) {
+    // Counters can be multiplexed when the PMU runs out of registers, the
+    // enabled and running times let us scale them back.
+    attr.disabled = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  } else {
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+  }
+  return static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+// Counters of one thread, grouped so that a single read() returns them all.
+struct ThreadCounters {
+  ThreadCounters() {
+    for (int i = 0; i < kPerfCounterCount; ++i) {
+      int fd = open_counter(i, false, leader);
+      if (fd < 0) continue;
+      if (leader < 0) leader = fd;
+      fds[i] = fd;
+      ioctl(fd, PERF_EVENT_IOC_ID, &ids[i]);
+    }
+  }
+  ~ThreadCounters() {
+    for (int fd : fds) {
+      if (fd >= 0) close(fd);
+    }
+  }
+
+  int leader = -1;
+  int fds[kPerfCounterCount] = {-1, -1, -1, -1};
+  uint64_t ids[kPerfCounterCount] = {};
+};
+
+#endif
+
+}  // namespace
+
+const char* perf_counter_name(PerfCounter counter) {
+  static const char* kNames[kPerfCounterCount] = {
+      "cycles",
+      "instructions",
+      "branch-misses",
+      "llc-misses",
+  };
+  return kNames[static_cast<int>(counter)];
+}
+
+ProcessPerfCounters::ProcessPerfCounters() {
+  for (int& fd : fds_) fd = -1;
+#if defined(HAS_PERF_EVENT)
+  for (int i = 0; i < kPerfCounterCount; ++i) {
+    fds_[i] = open_counter(i, true, -1);
+    if (fds_[i] < 0 && error_.empty()) {
+      error_ = std::string("perf_event_open: ") + std::strerror(errno);
+    }
+  }
+#else
+  error_ = "perf_event_open is only available on Linux";
+#endif
+}
+
+ProcessPerfCounters::~ProcessPerfCounters() {
+#if defined(HAS_PERF_EVENT)
+  for (int fd : fds_) {
+    if (fd >= 0) close(fd);
+  }
+#endif
+}
+
+bool ProcessPerfCounters::available() const {
+  for (int fd : fds_) {
+    if (fd >= 0) return true;
+  }
+  return false;
+}
+
+void ProcessPerfCounters::Start() {
+#if defined(HAS_PERF_EVENT)
+  for (int fd : fds_) {
+    if (fd < 0) continue;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+}
+
+PerfCounts ProcessPerfCounters::Stop() {
+  PerfCounts counts;
+#if defined(HAS_PERF_EVENT)
+  for (int i = 0; i < kPerfCounterCount; ++i) {
+    if (fds_[i] < 0) continue;
+    ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+    // value, time enabled, time running
+    uint64_t data[3];
+    if (read(fds_[i], data, sizeof(data)) != sizeof(data) || data[2] == 0) {
+      continue;
+    }
+    counts.values[i] = data[2] < data[1]
+                           ? static_cast<uint64_t>(
+                                 static_cast<double>(data[0]) * data[1] /
+                                 data[2])
+                           : data[0];
+    counts.available[i] = true;
+  }
+#endif
+  return counts;
+}
+
+bool read_thread_perf_counters(PerfCounts* counts) {
+#if defined(HAS_PERF_EVENT)
+  thread_local ThreadCounters counters;
+  if (counters.leader < 0) return false;
+  // nr, then a value and id pair per counter.
+  uint64_t data[1 + 2 * kPerfCounterCount];
+  ssize_t bytes = read(counters.leader, data, sizeof(data));
+  if (bytes < static_cast<ssize_t>(sizeof(uint64_t))) return false;
+  for (uint64_t j = 0; j < data[0]; ++j) {
+    for (int i = 0; i < kPerfCounterCount; ++i) {
+      if (counters.fds[i] >= 0 && counters.ids[i] == data[2 + 2 * j]) {
+        counts->values[i] = data[1 + 2 * j];
+        counts->available[i] = true;
+      }
+    }
+  }
+  return true;
+#else
+  (void)counts;
+  return false;
+#endif
+}
+
+void print_perf_counters(const PerfCounts& counts, uint64_t positions) {
+  std::cout << "Performance counters (all threads, user space):\n";
+  for (int i = 0; i < kPerfCounterCount; ++i) {
+    char line[128];
+    const char* name = perf_counter_name(static_cast<PerfCounter>(i));
+    if (!counts.available[i]) {
+      std::snprintf(line, sizeof(line), "  %-14s %16s\n", name,
+                    "unavailable");
+    } else {
+      std::snprintf(line, sizeof(line), "  %-14s %16llu %12.1f /position\n",
+                    name, static_cast<unsigned long long>(counts.values[i]),
+                    positions ? static_cast<double>(counts.values[i]) /
+                                    positions
+                              : 0.0);
+    }
+    std::cout << line;
+  }
+  const int kCycles = static_cast<int>(PerfCounter::CYCLES);
+  const int kInstructions = static_cast<int>(PerfCounter::INSTRUCTIONS);
+  if (counts.available[kCycles] && counts.available[kInstructions] &&
+      counts.values[kCycles] > 0) {
+    char line[64];
+    std::snprintf(line, sizeof(line), "  %-14s %16.2f\n", "IPC",
+                  static_cast<double>(counts.values[kInstructions]) /
+                      counts.values[kCycles]);
+    std::cout << line;
+  }
+  std::cout << std::flush;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// Hardware performance counters through Linux perf_event_open(). Counters the
+// kernel or the CPU doesn't provide (other systems, VMs, perf_event_paranoid)
+// are reported as unavailable and the conversion runs as usual.
+
+#include <cstdint>
+#include <string>
+
+enum class PerfCounter {
+  CYCLES,
+  INSTRUCTIONS,
+  BRANCH_MISSES,
+  LLC_MISSES,
+};
+const int kPerfCounterCount = 4;
+
+const char* perf_counter_name(PerfCounter counter);
+
+struct PerfCounts {
+  uint64_t values[kPerfCounterCount] = {};
+  bool available[kPerfCounterCount] = {};
+};
+
+// Counts user space events of the whole process. Threads started after
+// Start() are included once they have exited, so join them before Stop().
+class ProcessPerfCounters {
+ public:
+  ProcessPerfCounters();
+  ~ProcessPerfCounters();
+
+  // False when no counter could be opened, error() tells why.
+  bool available() const;
+  const std::string& error() const { return error_; }
+
+  void Start();
+  PerfCounts Stop();
+
+ private:
+  int fds_[kPerfCounterCount];
+  std::string error_;
+};
+
+// Reads the calling thread's counters, opening them on first use. Returns
+// false when none are available. Meant for short scopes: a single read()
+// returns all counters.
+bool read_thread_perf_counters(PerfCounts* counts);
+
+// Prints totals, IPC and counts per position.
+void print_perf_counters(const PerfCounts& counts, uint64_t positions);
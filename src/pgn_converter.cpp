@@ -0,0 +1,305 @@
+#include "pgn_converter.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "chess/board.h"
+#include "eval_comment.h"
+#include "polyglot_lib.h"
+#include "stage_timer.h"
+#include "training_data.h"
+#include "util.h"
+#include "utils/filesystem.h"
+
+lczero::Move poly_move_to_lc0_move(move_t move, board_t* board) {
+  lczero::BoardSquare from(square_rank(move_from(move)),
+                           square_file(move_from(move)));
+  lczero::BoardSquare to(square_rank(move_to(move)),
+                         square_file(move_to(move)));
+  lczero::Move m(from, to);
+
+  if (move_is_promote(move)) {
+    lczero::Move::Promotion lookup[5] = {
+        lczero::Move::Promotion::None,   lczero::Move::Promotion::Knight,
+        lczero::Move::Promotion::Bishop, lczero::Move::Promotion::Rook,
+        lczero::Move::Promotion::Queen,
+    };
+    auto prom = lookup[move >> 12];
+    m.SetPromotion(prom);
+  } else if (move_is_castle(move, board)) {
+    bool is_short_castle =
+        square_file(move_from(move)) < square_file(move_to(move));
+    int file_to = is_short_castle ? 6 : 2;
+    m.SetTo(lczero::BoardSquare(square_rank(move_to(move)), file_to));
+    m.SetCastling();
+  }
+
+  if (colour_is_black(board->turn)) {
+    m.Mirror();
+  }
+
+  return m;
+}
+
+bool next_move(pgn_t* pgn, char* str, int size) {
+  STAGE_TIMER(Stage::PGN_PARSE);
+  return pgn_next_move(pgn, str, size);
+}
+
+bool next_game(pgn_t* pgn) {
+  STAGE_TIMER(Stage::PGN_PARSE);
+  return pgn_next_game(pgn);
+}
+
+bool convert_game(pgn_t* pgn, int game_id, const Options& options,
+                  const ScoreToQ& score_to_q, GameRecords* game,
+                  ConversionStats* stats, AsyncTrainingDataWriter* writer) {
+  stats->games_read++;
+  std::string starting_fen = normalize_starting_fen(
+      std::strlen(pgn->fen) > 0 ? pgn->fen : lczero::ChessBoard::kStartposFen);
+
+  if (options.verbose) {
+    std::cout << "Started new game, starting FEN: \'" << starting_fen << "\'"
+              << '\n';
+  }
+
+  lczero::PositionHistory position_history;
+  reset_position_history(starting_fen, &position_history);
+  board_t board[1];
+  board_from_fen(board, starting_fen.c_str());
+  char str[256];
+  bool game_failed = false;
+  size_t positions = 0;
+
+  lczero::GameResult game_result;
+  if (options.verbose) {
+    std::cout << "Game result: " << pgn->result << '\n';
+  }
+  if (my_string_equal(pgn->result, "1-0")) {
+    game_result = lczero::GameResult::WHITE_WON;
+  } else if (my_string_equal(pgn->result, "0-1")) {
+    game_result = lczero::GameResult::BLACK_WON;
+  } else {
+    game_result = lczero::GameResult::DRAW;
+  }
+
+  while (next_move(pgn, str, 256)) {
+    // Extract move from pgn
+    int move;
+    {
+      STAGE_TIMER(Stage::SAN_TO_MOVE);
+      move = move_from_san(str, board);
+      if (move != MoveNone && !move_is_legal(move, board)) move = MoveNone;
+    }
+    if (move == MoveNone) {
+      std::cout << "illegal move \"" << str << "\" at line " << pgn->move_line
+                << ", column " << pgn->move_column << '\n';
+      stats->Reject(RejectReason::ILLEGAL_MOVE);
+      game_failed = true;
+      break;
+    }
+
+    if (options.verbose) {
+      move_to_san(move, board, str, 256);
+      std::cout << "Read move: " << str << '\n';
+      if (pgn->last_read_comment[0]) {
+        std::cout << str << " pgn comment: " << pgn->last_read_comment
+                  << '\n';
+      }
+    }
+
+    bool bad_move = false;
+    if (pgn->last_read_nag[0]) {
+      // If the move is bad or dubious, skip it.
+      // See https://en.wikipedia.org/wiki/Numeric_Annotation_Glyphs for PGN
+      // NAGs
+      if (pgn->last_read_nag[0] == '2' || pgn->last_read_nag[0] == '4' ||
+          pgn->last_read_nag[0] == '5' || pgn->last_read_nag[0] == '6') {
+        bad_move = true;
+      }
+    }
+
+    // Extract SF scores, they are converted to win probability once the
+    // whole game is read
+    bool has_score = false;
+    float fishtest_score = 0.0f;
+    if (pgn->last_read_comment[0]) {
+      if (move_is_mate(move, board)) {
+        fishtest_score = position_history.Last().IsBlackToMove() ? -128.0f : 128.0f;
+      } else {
+        EvalComment eval;
+        bool success;
+        {
+          STAGE_TIMER(Stage::COMMENT_PARSE);
+          success = parse_eval_comment(pgn->last_read_comment, &eval);
+        }
+        if (!success) {
+          break;  // Comment contained no "%eval"
+        }
+        fishtest_score = eval.score;
+      }
+      has_score = true;
+    } else if (options.fishtest_mode) {
+      // This game has no comments, skip it.
+      break;
+    }
+
+    // Convert move to lc0 format
+    lczero::Move lc0_move;
+    lczero::MoveList legal_moves;
+    bool found = false;
+    {
+      STAGE_TIMER(Stage::LEGAL_MOVES);
+      lc0_move = poly_move_to_lc0_move(move, board);
+      legal_moves = position_history.Last().GetBoard().GenerateLegalMoves();
+      for (auto legal : legal_moves) {
+        if (legal == lc0_move && legal.castling() == lc0_move.castling()) {
+          found = true;
+          break;
+        }
+      }
+    }
+    if (!found) {
+      // Reported, and converted anyway like lc0 selfplay would.
+      std::cout << "Move not found: " << str << " " << game_id << " "
+                << square_file(move_to(move)) << '\n';
+      stats->moves_not_found++;
+    }
+
+    if (options.game_stream) {
+      // Training data is generated later by the game stream expander
+      if (writer &&
+          game->stream.plies.size() == game->stream.plies.capacity()) {
+        writer->Grow(game);
+      }
+      game->stream.plies.push_back(
+          make_game_stream_ply(lc0_move, bad_move, has_score, fishtest_score));
+    } else if (!bad_move) {
+      // Generate training data
+      if (writer && game->records.size() == game->records.capacity()) {
+        writer->Grow(game);
+      }
+      game->records.push_back(get_v4_training_data(
+          game_result, position_history, lc0_move, legal_moves, 0.0f));
+      game->scores.push_back(fishtest_score);
+      if (!writer) game->policy_indices.push_back(lc0_move.as_nn_index());
+    }
+    if (!bad_move) positions++;
+
+    // Execute move
+    STAGE_TIMER(Stage::PLAY_MOVE);
+    position_history.Append(lc0_move);
+    move_do(board, move);
+  }
+
+  if (options.verbose) {
+    std::cout << "Game end." << '\n';
+  }
+
+  // Fast-forward any remaining move
+  while (next_move(pgn, str, 256))
+    ;
+
+  // A game that failed halfway is dropped as a whole.
+  if (game_failed || positions == 0) {
+    if (!game_failed) stats->Reject(RejectReason::NO_POSITIONS);
+    return false;
+  }
+  stats->games_accepted++;
+  set_training_data_q(score_to_q, &game->scores, &game->records);
+  game->game_id = game_id;
+  game->stream.game_id = game_id;
+  game->stream.result = game_result;
+  game->stream.starting_fen = starting_fen;
+  return true;
+}
+
+bool write_one_game_training_data(pgn_t* pgn, int game_id, Options options,
+                                  const ScoreToQ& score_to_q,
+                                  AsyncTrainingDataWriter* writer,
+                                  ConversionStats* stats) {
+  GameRecords* game = writer->Acquire();
+  bool converted;
+  try {
+    converted =
+        convert_game(pgn, game_id, options, score_to_q, game, stats, writer);
+  } catch (const PolyglotError&) {
+    stats->Reject(RejectReason::PARSE_ERROR);
+    writer->Release(game);
+    throw;
+  }
+  if (!converted) {
+    writer->Release(game);
+    return false;
+  }
+  game->directory =
+      "supervised-" + std::to_string(game_id / options.games_per_directory);
+  writer->Submit(game);
+  return true;
+}
+
+size_t convert_pgn_file(const std::string& filename, const Options& options,
+                        const ScoreToQ& score_to_q,
+                        AsyncTrainingDataWriter* writer,
+                        ConversionStats* stats, int* game_id,
+                        size_t max_games) {
+  uint64_t start_input_bytes = stats->input_bytes;
+  size_t games = 0;
+  pgn_t pgn[1];
+  if (options.verbose) {
+    std::cout << "Opening \'" << filename << "\'" << std::endl;
+  }
+  pgn_open(pgn, filename.c_str());
+  try {
+    while (games < max_games && next_game(pgn)) {
+      games++;
+      bool game_written = write_one_game_training_data(
+          pgn, *game_id, options, score_to_q, writer, stats);
+      if (game_written) (*game_id)++;
+      stats->input_bytes = start_input_bytes + std::ftell(pgn->file);
+    }
+  } catch (const PolyglotError& e) {
+    // The parser can't resynchronize, the rest of the file is lost.
+    std::cout << "PGN error in \'" << filename << "\': " << e.what()
+              << ", skipping the rest of the file" << '\n';
+  }
+  pgn_close(pgn);
+  stats->input_bytes = start_input_bytes + lczero::GetFileSize(filename);
+  return games;
+}
+
+bool convert_pgn_file_ids(const std::string& filename, const Options& options,
+                          const ScoreToQ& score_to_q,
+                          AsyncTrainingDataWriter* writer,
+                          ConversionStats* stats,
+                          std::atomic<int>* next_game_id, int end_game_id) {
+  // Other readers update stats->input_bytes too, only add to it.
+  uint64_t input_bytes = 0;
+  pgn_t pgn[1];
+  if (options.verbose) {
+    std::cout << "Opening \'" << filename << "\'" << std::endl;
+  }
+  pgn_open(pgn, filename.c_str());
+  bool games_left = false;
+  try {
+    while (next_game(pgn)) {
+      int game_id = (*next_game_id)++;
+      if (game_id >= end_game_id) {
+        games_left = true;
+        break;
+      }
+      write_one_game_training_data(pgn, game_id, options, score_to_q, writer,
+                                   stats);
+      uint64_t position = std::ftell(pgn->file);
+      stats->input_bytes += position - input_bytes;
+      input_bytes = position;
+    }
+  } catch (const PolyglotError& e) {
+    std::cout << "PGN error in \'" << filename << "\': " << e.what()
+              << ", skipping the rest of the file" << '\n';
+  }
+  pgn_close(pgn);
+  stats->input_bytes += lczero::GetFileSize(filename) - input_bytes;
+  return games_left;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// Conversion of PGN games, as read by polyglot, into training data.
+
+#include <atomic>
+#include <string>
+
+#include "async_writer.h"
+#include "chess/bitboard.h"
+#include "board.h"
+#include "move.h"
+#include "pgn.h"
+#include "score_to_q.h"
+#include "stats.h"
+
+struct Options {
+  bool verbose = false;
+  bool fishtest_mode = false;
+  // Record games as game streams instead of expanded training records.
+  bool game_stream = false;
+  double score_scale = kDefaultScoreScale;
+  size_t games_per_directory = 10000;
+};
+
+lczero::Move poly_move_to_lc0_move(move_t move, board_t* board);
+
+// pgn_next_move() and pgn_next_game(), timed as Stage::PGN_PARSE.
+bool next_move(pgn_t* pgn, char* str, int size);
+bool next_game(pgn_t* pgn);
+
+// Converts the game |pgn| is positioned at into the empty buffer |game|.
+// Returns false, with the reason counted in |stats|, when the game produced
+// no training data; the buffer then holds a partial game. |writer|, when
+// set, grows the buffer within its memory budget. Without one, the policy
+// index of every played move is kept in |game|->policy_indices as well.
+bool convert_game(pgn_t* pgn, int game_id, const Options& options,
+                  const ScoreToQ& score_to_q, GameRecords* game,
+                  ConversionStats* stats, AsyncTrainingDataWriter* writer);
+
+// Converts the game |pgn| is positioned at and submits it to |writer| with
+// id |game_id|. Returns whether the game produced any training data.
+bool write_one_game_training_data(pgn_t* pgn, int game_id, Options options,
+                                  const ScoreToQ& score_to_q,
+                                  AsyncTrainingDataWriter* writer,
+                                  ConversionStats* stats);
+
+// Converts up to |max_games| games of |filename|, numbering the written
+// ones from |*game_id| on without gaps, and returns the number of games
+// read, rejected ones included. stats->input_bytes advances by the size of
+// the file.
+size_t convert_pgn_file(const std::string& filename, const Options& options,
+                        const ScoreToQ& score_to_q,
+                        AsyncTrainingDataWriter* writer,
+                        ConversionStats* stats, int* game_id,
+                        size_t max_games);
+
+// Converts the games of |filename|, numbering them in input order with ids
+// taken from |*next_game_id| until an id reaches |end_game_id|. Rejected
+// games keep their id, which leaves a gap. Readers of several files may
+// share the counter. stats->input_bytes advances by the size of the file.
+// Returns whether games were left in the file when the ids ran out.
+bool convert_pgn_file_ids(const std::string& filename, const Options& options,
+                          const ScoreToQ& score_to_q,
+                          AsyncTrainingDataWriter* writer,
+                          ConversionStats* stats,
+                          std::atomic<int>* next_game_id, int end_game_id);
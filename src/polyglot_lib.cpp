@@ -1,7 +1,10 @@
 // From https://github.com/rozim/ChessData
 
-#include <assert.h>
-#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <mutex>
 #include <vector>
 
 #include "polyglot_lib.h"
@@ -23,18 +26,45 @@
 using std::vector;
 
 void polyglot_init() {
-  util_init();
-  option_init();
-  square_init();
-  piece_init();
-  attack_init();
-  hash_init();
-  my_random_init();
+  static std::once_flag once;
+  std::call_once(once, []() {
+    util_init();
+    option_init();
+    square_init();
+    piece_init();
+    attack_init();
+    hash_init();
+    my_random_init();
+  });
+}
+
+void polyglot_quit() { throw PolyglotError("polyglot_quit()"); }
+
+// polyglot's own my_fatal() prints the message and exits. util.cpp is built
+// with it renamed (see CMakeLists.txt), so the rest of polyglot calls this
+// one, which leaves the decision to the caller.
+void my_fatal(const char format[], ...) {
+  char message[1024];
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(message, sizeof(message), format, ap);
+  va_end(ap);
+  size_t length = strlen(message);
+  while (length > 0 && message[length - 1] == '\n') message[--length] = '\0';
+  throw PolyglotError(message);
 }
 
-void polyglot_quit() {
-  fprintf(stderr, "QUIT");
-  abort();
-  assert(false);
-  exit(100);
+bool pgn_open_memory(pgn_t* pgn, const char* data, size_t size) {
+#if defined(_WIN32)
+  return false;
+#else
+  // pgn_open() only sets up the parser state, the stream is swapped before
+  // anything is read.
+  FILE* file = fmemopen(const_cast<char*>(data), size, "r");
+  if (file == NULL) return false;
+  pgn_open(pgn, "/dev/null");
+  fclose(pgn->file);
+  pgn->file = file;
+  return true;
+#endif
 }
@@ -19,8 +19,26 @@
 #include "search.h"
 #include "square.h"
 
+#include "utils/exception.h"
+
+// Thrown instead of terminating the process on polyglot's fatal errors, e.g.
+// a PGN syntax error. The pgn_t it happened in can only be closed.
+class PolyglotError : public lczero::Exception {
+ public:
+  using lczero::Exception::Exception;
+};
+
 // dss: init everything
+// Only the first call initializes the tables, later and concurrent calls
+// wait for it. Afterwards the tables are read only, so separate pgn_t and
+// board_t instances can be used from different threads.
 extern void polyglot_init();
+// Throws PolyglotError.
 extern void polyglot_quit();
 
+// pgn_open() on |size| bytes of PGN text in memory, which must stay valid
+// until pgn_close(). Returns false where that isn't supported (Windows) or
+// when |size| is 0.
+extern bool pgn_open_memory(pgn_t* pgn, const char* data, size_t size);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "record_check.h"
+
+#include <cstddef>
+#include <cstring>
+
+namespace {
+
+struct Field {
+  const char* name;
+  size_t offset;
+  size_t size;
+};
+
+#define TRAINING_DATA_FIELD(name)                  \
+  {                                                \
+    #name, offsetof(lczero::V4TrainingData, name), \
+        sizeof(lczero::V4TrainingData::name)       \
+  }
+
+const Field kFields[kTrainingDataFieldCount] = {
+    TRAINING_DATA_FIELD(version),
+    TRAINING_DATA_FIELD(probabilities),
+    TRAINING_DATA_FIELD(planes),
+    TRAINING_DATA_FIELD(castling_us_ooo),
+    TRAINING_DATA_FIELD(castling_us_oo),
+    TRAINING_DATA_FIELD(castling_them_ooo),
+    TRAINING_DATA_FIELD(castling_them_oo),
+    TRAINING_DATA_FIELD(side_to_move),
+    TRAINING_DATA_FIELD(rule50_count),
+    TRAINING_DATA_FIELD(move_count),
+    TRAINING_DATA_FIELD(result),
+    TRAINING_DATA_FIELD(root_q),
+    TRAINING_DATA_FIELD(best_q),
+    TRAINING_DATA_FIELD(root_d),
+    TRAINING_DATA_FIELD(best_d),
+};
+
+#undef TRAINING_DATA_FIELD
+
+const uint64_t kFnvOffset = 14695981039346656037ull;
+const uint64_t kFnvPrime = 1099511628211ull;
+
+}  // namespace
+
+const char* training_data_field_name(int field) { return kFields[field].name; }
+
+int training_data_difference(const lczero::V4TrainingData& a,
+                             const lczero::V4TrainingData& b) {
+  const char* a_bytes = reinterpret_cast<const char*>(&a);
+  const char* b_bytes = reinterpret_cast<const char*>(&b);
+  for (int i = 0; i < kTrainingDataFieldCount; ++i) {
+    if (std::memcmp(a_bytes + kFields[i].offset, b_bytes + kFields[i].offset,
+                    kFields[i].size) != 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+TrainingDataHasher::TrainingDataHasher() {
+  for (auto& hash : hashes_) hash = kFnvOffset;
+}
+
+void TrainingDataHasher::Add(const lczero::V4TrainingData& record) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&record);
+  for (int i = 0; i < kTrainingDataFieldCount; ++i) {
+    uint64_t hash = hashes_[i];
+    for (size_t j = 0; j < kFields[i].size; ++j) {
+      hash = (hash ^ bytes[kFields[i].offset + j]) * kFnvPrime;
+    }
+    hashes_[i] = hash;
+  }
+  records_++;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// Field by field comparison and hashing of training records. Used to prove
+// that alternative conversion paths write exactly the same bytes as the
+// reference one, NaN policy entries and negative zeros included.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "neural/writer.h"
+
+const int kTrainingDataFieldCount = 15;
+
+// Name of V4TrainingData field |field|, in record order.
+const char* training_data_field_name(int field);
+
+// Returns the first field whose bytes differ between |a| and |b|, or -1.
+int training_data_difference(const lczero::V4TrainingData& a,
+                             const lczero::V4TrainingData& b);
+
+// FNV-1a hash of every field over a sequence of records.
+class TrainingDataHasher {
+ public:
+  TrainingDataHasher();
+
+  void Add(const lczero::V4TrainingData& record);
+
+  size_t records() const { return records_; }
+  uint64_t hash(int field) const { return hashes_[field]; }
+
+ private:
+  size_t records_ = 0;
+  uint64_t hashes_[kTrainingDataFieldCount];
+};
@@ -0,0 +1,34 @@
+#include "score_to_q.h"
+
+#include <cmath>
+
+namespace {
+const long kTableCentipawns = 12800;
+}  // namespace
+
+ScoreModel logistic_score_model(double scale) {
+  return [scale](float score) -> float {
+    return 2 / (1 + exp(-scale * score)) - 1;
+  };
+}
+
+ScoreToQ::ScoreToQ(ScoreModel model) : model_(std::move(model)) {
+  table_.resize(2 * kTableCentipawns + 1);
+  for (long cp = -kTableCentipawns; cp <= kTableCentipawns; ++cp) {
+    table_[cp + kTableCentipawns] = model_(static_cast<float>(cp) / 100.0f);
+  }
+}
+
+float ScoreToQ::Convert(float score) const {
+  long cp = std::lround(score * 100.0f);
+  // Only use the table when it was built from this very float.
+  if (cp >= -kTableCentipawns && cp <= kTableCentipawns &&
+      static_cast<float>(cp) / 100.0f == score) {
+    return table_[cp + kTableCentipawns];
+  }
+  return model_(score);
+}
+
+void ScoreToQ::Convert(const float* scores, float* q, size_t count) const {
+  for (size_t i = 0; i < count; ++i) q[i] = Convert(scores[i]);
+}
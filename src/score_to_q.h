@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Maps an engine score in pawns to a Q value in [-1, 1].
+using ScoreModel = std::function<float(float score)>;
+
+// 2 / (1 + exp(-scale * score)) - 1. With scale 0.4 this is exactly
+// convert_sf_score_to_win_probability().
+ScoreModel logistic_score_model(double scale);
+
+const double kDefaultScoreScale = 0.4;
+
+// Evaluates a score model through a table with one entry per centipawn, up to
+// the +/-128 pawns used for mates. PGN comments carry two decimals, so nearly
+// every score hits the table and gets exactly the value the model would
+// return; other scores fall back to calling the model.
+class ScoreToQ {
+ public:
+  explicit ScoreToQ(ScoreModel model);
+
+  float Convert(float score) const;
+  // Converts a whole game's worth of scores at once.
+  void Convert(const float* scores, float* q, size_t count) const;
+
+ private:
+  ScoreModel model_;
+  std::vector<float> table_;
+};
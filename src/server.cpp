@@ -0,0 +1,339 @@
+#include "server.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "converter.h"
+#include "polyglot_lib.h"
+#include "utils/exception.h"
+
+namespace {
+
+volatile std::sig_atomic_t stop_signal = 0;
+
+void handle_stop_signal(int) { stop_signal = 1; }
+
+void put_le(uint64_t value, int bytes, char* out) {
+  for (int i = 0; i < bytes; ++i) {
+    out[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+}
+
+uint64_t get_le(const char* in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i]))
+             << (8 * i);
+  }
+  return value;
+}
+
+#if !defined(_WIN32)
+
+// Returns false on end of file before the first byte.
+bool read_full(int fd, char* data, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t bytes = read(fd, data + done, size - done);
+    if (bytes < 0 && errno == EINTR) continue;
+    if (bytes < 0) {
+      throw lczero::Exception(std::string("read failed: ") +
+                              std::strerror(errno));
+    }
+    if (bytes == 0) {
+      if (done == 0) return false;
+      throw lczero::Exception("Connection closed in the middle of a frame");
+    }
+    done += bytes;
+  }
+  return true;
+}
+
+void write_full(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t bytes = write(fd, data, size);
+    if (bytes < 0 && errno == EINTR) continue;
+    if (bytes < 0) {
+      throw lczero::Exception(std::string("write failed: ") +
+                              std::strerror(errno));
+    }
+    data += bytes;
+    size -= bytes;
+  }
+}
+
+#endif
+
+void write_done(int fd, const ConversionStats& request, uint64_t positions) {
+  char payload[32];
+  put_le(request.games_read, 8, payload);
+  put_le(request.games_accepted, 8, payload + 8);
+  put_le(request.GamesRejected(), 8, payload + 16);
+  put_le(positions, 8, payload + 24);
+  write_frame(fd, FrameType::DONE, payload, sizeof(payload));
+}
+
+// The counts of a Converter's stats at one point in time.
+struct GameCounts {
+  explicit GameCounts(const ConversionStats& stats)
+      : games_read(stats.games_read),
+        games_accepted(stats.games_accepted),
+        positions(stats.positions_written) {
+    for (int i = 0; i < kRejectReasonCount; ++i) {
+      games_rejected[i] = stats.games_rejected[i];
+    }
+  }
+
+  // Adds what |stats| counted since the snapshot to |request|.
+  void AddSince(const ConversionStats& stats, ConversionStats* request) const {
+    request->games_read += stats.games_read - games_read;
+    request->games_accepted += stats.games_accepted - games_accepted;
+    for (int i = 0; i < kRejectReasonCount; ++i) {
+      request->games_rejected[i] += stats.games_rejected[i] - games_rejected[i];
+    }
+    request->positions_written += stats.positions_written - positions;
+  }
+
+  uint64_t games_read;
+  uint64_t games_accepted;
+  uint64_t games_rejected[kRejectReasonCount];
+  uint64_t positions;
+};
+
+void write_failed(int fd, const std::string& message) {
+  write_frame(fd, FrameType::FAILED, message.data(), message.size());
+}
+
+}  // namespace
+
+#if !defined(_WIN32)
+
+bool read_frame(int fd, FrameType* type, std::vector<char>* payload) {
+  char header[kFrameHeaderBytes];
+  if (!read_full(fd, header, sizeof(header))) return false;
+  *type = static_cast<FrameType>(get_le(header, 4));
+  uint64_t size = get_le(header + 4, 8);
+  if (size > kMaxFramePayload) {
+    throw lczero::Exception("Frame of " + std::to_string(size) +
+                            " bytes is too large");
+  }
+  payload->resize(size);
+  if (size > 0 && !read_full(fd, payload->data(), size)) {
+    throw lczero::Exception("Connection closed in the middle of a frame");
+  }
+  return true;
+}
+
+void write_frame(int fd, FrameType type, const void* payload, size_t size) {
+  char header[kFrameHeaderBytes];
+  put_le(static_cast<uint32_t>(type), 4, header);
+  put_le(size, 8, header + 4);
+  write_full(fd, header, sizeof(header));
+  write_full(fd, static_cast<const char*>(payload), size);
+}
+
+#else
+
+bool read_frame(int, FrameType*, std::vector<char>*) {
+  throw lczero::Exception("-serve needs Unix domain sockets");
+}
+
+void write_frame(int, FrameType, const void*, size_t) {
+  throw lczero::Exception("-serve needs Unix domain sockets");
+}
+
+#endif
+
+ConversionServer::ConversionServer(const std::string& socket_path,
+                                   const Options& options,
+                                   AsyncTrainingDataWriter* writer,
+                                   ConversionStats* stats, int first_game_id)
+    : socket_path_(socket_path),
+      options_(options),
+      score_to_q_(logistic_score_model(options.score_scale)),
+      writer_(writer),
+      stats_(stats),
+      next_game_id_(first_game_id) {
+#if defined(_WIN32)
+  throw lczero::Exception("-serve needs Unix domain sockets");
+#else
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    throw lczero::Exception("Socket path too long: " + socket_path);
+  }
+  std::strcpy(address.sun_path, socket_path.c_str());
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd_ < 0) {
+    throw lczero::Exception(std::string("socket failed: ") +
+                            std::strerror(errno));
+  }
+  // A socket file left by a server that didn't shut down cleanly.
+  unlink(socket_path.c_str());
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd_, 64) != 0) {
+    std::string error = std::strerror(errno);
+    close(listen_fd_);
+    throw lczero::Exception("Cannot listen on " + socket_path + ": " + error);
+  }
+#endif
+}
+
+ConversionServer::~ConversionServer() {
+#if !defined(_WIN32)
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+  }
+#endif
+}
+
+void ConversionServer::Run() {
+#if !defined(_WIN32)
+  // A client that goes away must not take the server with it.
+  std::signal(SIGPIPE, SIG_IGN);
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_stop_signal;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  std::cout << "Serving on " << socket_path_ << std::endl;
+  while (!stop_ && !stop_signal) {
+    pollfd listening = {listen_fd_, POLLIN, 0};
+    int ready = poll(&listening, 1, 200);
+    ReapConnections();
+    if (ready <= 0) continue;
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) continue;
+    // The thread records itself as finished under the lock, so it is in
+    // |threads_| by then.
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.insert(fd);
+    std::thread thread([this, fd]() { HandleConnection(fd); });
+    std::thread::id id = thread.get_id();
+    threads_[id] = std::move(thread);
+  }
+
+  // Requests in progress are answered, then the connections see the end of
+  // their input.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int fd : connections_) shutdown(fd, SHUT_RD);
+  }
+  for (auto& thread : threads_) thread.second.join();
+  threads_.clear();
+  finished_.clear();
+  std::cout << "Server stopped" << std::endl;
+#endif
+}
+
+void ConversionServer::ReapConnections() {
+  std::vector<std::thread> finished;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::thread::id id : finished_) {
+      auto thread = threads_.find(id);
+      finished.push_back(std::move(thread->second));
+      threads_.erase(thread);
+    }
+    finished_.clear();
+  }
+  // They have nothing left to do but return.
+  for (auto& thread : finished) thread.join();
+}
+
+void ConversionServer::HandleConnection(int fd) {
+#if !defined(_WIN32)
+  // Reused for every request of the connection.
+  Converter converter(options_);
+  TrainingDataBatch batch;
+  std::vector<char> payload;
+  try {
+    FrameType type;
+    while (read_frame(fd, &type, &payload)) {
+      ConversionStats request;
+      try {
+        if (type == FrameType::CONVERT) {
+          GameCounts before(converter.stats());
+          converter.Open(payload.data(), payload.size());
+          try {
+            while (converter.Next(&batch)) {
+              write_frame(fd, FrameType::RECORDS, batch.records.data(),
+                          batch.records.size() * sizeof(batch.records[0]));
+            }
+          } catch (const PolyglotError&) {
+            before.AddSince(converter.stats(), &request);
+            throw;
+          }
+          before.AddSince(converter.stats(), &request);
+          AddToTotals(request, payload.size());
+          write_done(fd, request, request.positions_written);
+        } else if (type == FrameType::CONVERT_AND_WRITE) {
+          ConvertAndWrite(payload, &request);
+          AddToTotals(request, payload.size());
+          write_done(fd, request, 0);
+        } else if (type == FrameType::SHUTDOWN) {
+          stop_ = true;
+          write_done(fd, request, 0);
+        } else {
+          write_failed(fd, "Unknown frame type " +
+                               std::to_string(static_cast<uint32_t>(type)));
+        }
+      } catch (const PolyglotError& e) {
+        AddToTotals(request, payload.size());
+        write_failed(fd, e.what());
+      }
+    }
+  } catch (const std::exception& e) {
+    // The connection is unusable, e.g. the client went away.
+    if (options_.verbose) {
+      std::cout << "Connection closed: " << e.what() << std::endl;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  connections_.erase(fd);
+  close(fd);
+  finished_.push_back(std::this_thread::get_id());
+#else
+  (void)fd;
+#endif
+}
+
+void ConversionServer::ConvertAndWrite(const std::vector<char>& pgn,
+                                       ConversionStats* request) {
+  pgn_t state[1];
+  if (!pgn_open_memory(state, pgn.data(), pgn.size())) return;
+  try {
+    while (next_game(state)) {
+      write_one_game_training_data(state, next_game_id_++, options_,
+                                   score_to_q_, writer_, request);
+    }
+  } catch (...) {
+    pgn_close(state);
+    throw;
+  }
+  pgn_close(state);
+}
+
+void ConversionServer::AddToTotals(const ConversionStats& request,
+                                   uint64_t input_bytes) {
+  stats_->games_read += request.games_read;
+  stats_->games_accepted += request.games_accepted;
+  for (int i = 0; i < kRejectReasonCount; ++i) {
+    stats_->games_rejected[i] += request.games_rejected[i];
+  }
+  // The writer counts the positions it writes itself.
+  stats_->input_bytes += input_bytes;
+}
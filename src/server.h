@@ -0,0 +1,89 @@
+#pragma once
+
+// Conversion daemon (-serve): keeps the initialized tables, the writer with
+// its buffers and open outputs, and per connection Converters warm, and
+// converts PGN sent over a Unix domain socket. Connections are served
+// concurrently, each on its own thread.
+//
+// Protocol: both sides exchange frames of a 12 byte header, a little endian
+// uint32 type and uint64 payload size, followed by the payload. A client
+// sends
+//   CONVERT with PGN text: the records come back in RECORDS frames (raw
+//     V4TrainingData records), followed by DONE,
+//   CONVERT_AND_WRITE with PGN text: the games go to the server's output
+//     (files, -o stream or -shm-ring) as in a normal run, followed by DONE,
+//   SHUTDOWN: answered with DONE. The server stops accepting connections,
+//     finishes the requests in progress and then closes every connection.
+// DONE carries four little endian uint64: games read, games accepted, games
+// rejected and, for CONVERT only, positions. On a PGN syntax error or a bad
+// request FAILED carries the message, the connection stays usable.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_writer.h"
+#include "pgn_converter.h"
+#include "score_to_q.h"
+#include "stats.h"
+
+enum class FrameType : uint32_t {
+  CONVERT = 1,
+  CONVERT_AND_WRITE = 2,
+  RECORDS = 3,
+  DONE = 4,
+  FAILED = 5,
+  SHUTDOWN = 6,
+};
+
+const size_t kFrameHeaderBytes = 12;
+// Larger payloads are refused.
+const uint64_t kMaxFramePayload = 1ULL << 30;
+
+// Reads one frame from |fd|. Returns false when the peer closed the
+// connection cleanly before a new frame. Throws on errors.
+bool read_frame(int fd, FrameType* type, std::vector<char>* payload);
+void write_frame(int fd, FrameType type, const void* payload, size_t size);
+
+class ConversionServer {
+ public:
+  // Listens on |socket_path|, replacing a stale socket file. Games written
+  // with CONVERT_AND_WRITE go to |writer| and are numbered from
+  // |first_game_id| on, in the order they are read; rejected games leave
+  // gaps. Totals of all requests are added to |stats|.
+  ConversionServer(const std::string& socket_path, const Options& options,
+                   AsyncTrainingDataWriter* writer, ConversionStats* stats,
+                   int first_game_id = 0);
+  // Closes and removes the socket.
+  ~ConversionServer();
+
+  // Serves connections until SIGINT, SIGTERM or a SHUTDOWN frame.
+  void Run();
+
+ private:
+  void HandleConnection(int fd);
+  // Joins the threads of connections that have been closed.
+  void ReapConnections();
+  void ConvertAndWrite(const std::vector<char>& pgn, ConversionStats* request);
+  void AddToTotals(const ConversionStats& request, uint64_t input_bytes);
+
+  const std::string socket_path_;
+  const Options options_;
+  const ScoreToQ score_to_q_;
+  AsyncTrainingDataWriter* writer_;
+  ConversionStats* stats_;
+  std::atomic<int> next_game_id_;
+  std::atomic<bool> stop_{false};
+  int listen_fd_ = -1;
+  std::mutex mutex_;
+  std::set<int> connections_;
+  std::map<std::thread::id, std::thread> threads_;
+  // Threads whose connection is closed, joined on the next accept.
+  std::vector<std::thread::id> finished_;
+};
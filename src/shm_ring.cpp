@@ -0,0 +1,265 @@
+#include "shm_ring.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "utils/exception.h"
+
+struct ShmRingHeader {
+  // Set last by the producer once everything else is initialized.
+  std::atomic<uint32_t> ready;
+  // sizeof(lczero::V4TrainingData), guards against mismatched builds.
+  uint32_t record_size;
+  uint64_t slot_size;
+  uint64_t capacity;
+  alignas(64) std::atomic<uint64_t> write_position;
+  std::atomic<uint32_t> closed;
+  alignas(64) std::atomic<uint64_t> read_position;
+};
+
+struct ShmRingSlot {
+  std::atomic<uint64_t> sequence;
+  int32_t game_id;
+  lczero::V4TrainingData record;
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "The ring needs lock free atomics");
+
+namespace {
+
+const size_t kCacheLine = 64;
+
+size_t round_up(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+size_t slots_offset() { return round_up(sizeof(ShmRingHeader), kCacheLine); }
+
+size_t slot_size() { return round_up(sizeof(ShmRingSlot), kCacheLine); }
+
+// Spins briefly, then yields, then sleeps: waits are usually short, but a
+// slow trainer can keep the producer waiting for a long time.
+void backoff(int* spins) {
+  if (++*spins < 64) return;
+  if (*spins < 128) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+}
+
+std::string error_message(const std::string& what, const std::string& name) {
+  return what + " " + name + ": " + std::strerror(errno);
+}
+
+}  // namespace
+
+ShmRing::~ShmRing() {
+#if !defined(_WIN32)
+  if (memory_) munmap(memory_, bytes_);
+#endif
+}
+
+uint64_t ShmRing::capacity() const { return header_->capacity; }
+
+uint64_t ShmRing::written() const { return header_->write_position; }
+
+uint64_t ShmRing::read() const { return header_->read_position; }
+
+bool ShmRing::closed() const { return header_->closed != 0; }
+
+void ShmRing::Map(int fd, size_t bytes) {
+#if defined(_WIN32)
+  (void)fd;
+  (void)bytes;
+#else
+  memory_ = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory_ == MAP_FAILED) {
+    memory_ = nullptr;
+    throw lczero::Exception(error_message("Cannot map", name_));
+  }
+  bytes_ = bytes;
+  header_ = static_cast<ShmRingHeader*>(memory_);
+#endif
+}
+
+ShmRingSlot* ShmRing::slot(uint64_t position) const {
+  return reinterpret_cast<ShmRingSlot*>(
+      static_cast<char*>(memory_) + slots_offset() +
+      (position & (header_->capacity - 1)) * header_->slot_size);
+}
+
+ShmRingProducer::ShmRingProducer(const std::string& name, size_t capacity) {
+#if defined(_WIN32)
+  (void)capacity;
+  throw lczero::Exception("Shared memory rings need POSIX shm_open()");
+#else
+  name_ = name;
+  uint64_t slots = 1;
+  while (slots < capacity) slots <<= 1;
+  size_t bytes = slots_offset() + slots * slot_size();
+
+  // A ring that is still open was left by a producer that died, carry on
+  // where it stopped. Anything else is replaced.
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd >= 0) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == bytes) {
+      Map(fd, bytes);
+      if (header_->ready == 1 && header_->closed == 0 &&
+          header_->record_size == sizeof(lczero::V4TrainingData) &&
+          header_->capacity == slots) {
+        // The producer may have died between publishing a record and
+        // advancing the write position. Slots that hold a record or were
+        // already released at or after the write position are skipped.
+        uint64_t position = header_->write_position;
+        for (uint64_t i = 0; i < slots; ++i, ++position) {
+          uint64_t sequence = slot(position)->sequence;
+          if (sequence != position + 1 && sequence != position + slots) break;
+        }
+        header_->write_position = position;
+        return;
+      }
+      munmap(memory_, bytes_);
+      memory_ = nullptr;
+      header_ = nullptr;
+    } else {
+      close(fd);
+    }
+    shm_unlink(name.c_str());
+  }
+
+  fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) throw lczero::Exception(error_message("Cannot create", name));
+  if (ftruncate(fd, bytes) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    throw lczero::Exception(error_message("Cannot size", name));
+  }
+  Map(fd, bytes);
+  header_->record_size = sizeof(lczero::V4TrainingData);
+  header_->slot_size = slot_size();
+  header_->capacity = slots;
+  header_->write_position = 0;
+  header_->closed = 0;
+  header_->read_position = 0;
+  for (uint64_t i = 0; i < slots; ++i) slot(i)->sequence = i;
+  header_->ready.store(1, std::memory_order_release);
+#endif
+}
+
+ShmRingProducer::~ShmRingProducer() {
+  if (header_) Close();
+}
+
+void ShmRingProducer::Publish(const lczero::V4TrainingData& record,
+                              int game_id) {
+  uint64_t position =
+      header_->write_position.load(std::memory_order_relaxed);
+  ShmRingSlot* s = slot(position);
+  int spins = 0;
+  while (s->sequence.load(std::memory_order_acquire) != position) {
+    backoff(&spins);
+  }
+  s->game_id = game_id;
+  std::memcpy(&s->record, &record, sizeof(record));
+  s->sequence.store(position + 1, std::memory_order_release);
+  header_->write_position.store(position + 1, std::memory_order_release);
+}
+
+void ShmRingProducer::Close() {
+  header_->closed.store(1, std::memory_order_release);
+}
+
+ShmRingConsumer::ShmRingConsumer(const std::string& name,
+                                 int timeout_seconds) {
+#if defined(_WIN32)
+  (void)timeout_seconds;
+  throw lczero::Exception("Shared memory rings need POSIX shm_open()");
+#else
+  name_ = name;
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(timeout_seconds);
+  while (true) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 &&
+        static_cast<size_t>(st.st_size) > slots_offset()) {
+      // The size is final once it is set.
+      Map(fd, st.st_size);
+      while (header_->ready.load(std::memory_order_acquire) != 1) {
+        if (std::chrono::steady_clock::now() > deadline) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      if (header_->ready == 1) break;
+    } else if (fd >= 0) {
+      close(fd);
+    }
+    if (std::chrono::steady_clock::now() > deadline) {
+      throw lczero::Exception("Timed out waiting for ring " + name);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  if (header_->record_size != sizeof(lczero::V4TrainingData)) {
+    throw lczero::Exception("Ring " + name + " holds records of " +
+                            std::to_string(header_->record_size) +
+                            " bytes, expected " +
+                            std::to_string(sizeof(lczero::V4TrainingData)));
+  }
+#endif
+}
+
+bool ShmRingConsumer::Acquire(ShmRingRecord* record) {
+  uint64_t position = header_->read_position.load(std::memory_order_relaxed);
+  int spins = 0;
+  while (true) {
+    ShmRingSlot* s = slot(position);
+    uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+    int64_t difference = static_cast<int64_t>(sequence - (position + 1));
+    if (difference == 0) {
+      if (header_->read_position.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        record->record = &s->record;
+        record->game_id = s->game_id;
+        record->position = position;
+        return true;
+      }
+    } else if (difference < 0) {
+      // Nothing published at |position| yet. Once closed, the write
+      // position is final.
+      if (header_->closed.load(std::memory_order_acquire) &&
+          header_->write_position.load(std::memory_order_acquire) <=
+              position) {
+        return false;
+      }
+      backoff(&spins);
+      position = header_->read_position.load(std::memory_order_relaxed);
+    } else {
+      // Another consumer got there first.
+      position = header_->read_position.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void ShmRingConsumer::Release(const ShmRingRecord& record) {
+  slot(record.position)
+      ->sequence.store(record.position + header_->capacity,
+                       std::memory_order_release);
+}
+
+void ShmRingConsumer::Unlink() {
+#if !defined(_WIN32)
+  shm_unlink(name_.c_str());
+#endif
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+// Training records published in a named POSIX shared memory ring buffer, for
+// a trainer that runs next to the converter and reads positions as they are
+// produced instead of from gzip files.
+//
+// One producer (a writer thread) per ring, any number of consumer processes.
+// Every slot carries a sequence number: it equals the slot's position while
+// the slot is free for the producer, the position + 1 once the record is
+// published, and it advances by the capacity when a consumer releases the
+// slot. Consumers claim positions with a compare-and-swap on the read
+// position, so each record goes to exactly one consumer, and read it in
+// place. The producer waits while the ring is full, which throttles the
+// conversion to the speed of the trainer.
+//
+// The producer creates the ring, or continues one that is still open (a
+// restarted -procs worker), and marks it closed when it is done. It never
+// removes the name; consumers do once they have seen the end of the stream.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "neural/writer.h"
+
+// Records a ring holds by default, about 34 MB.
+const size_t kDefaultShmRingRecords = 4096;
+
+struct ShmRingHeader;
+struct ShmRingSlot;
+
+// The mapping of one ring.
+class ShmRing {
+ public:
+  ~ShmRing();
+
+  uint64_t capacity() const;
+  // Positions published and claimed so far, for monitoring.
+  uint64_t written() const;
+  uint64_t read() const;
+  bool closed() const;
+
+ protected:
+  ShmRing() = default;
+  void Map(int fd, size_t bytes);
+  ShmRingSlot* slot(uint64_t position) const;
+
+  std::string name_;
+  void* memory_ = nullptr;
+  size_t bytes_ = 0;
+  ShmRingHeader* header_ = nullptr;
+};
+
+class ShmRingProducer : public ShmRing {
+ public:
+  // Creates the ring |name| (e.g. "/trainingdata") with room for
+  // |capacity| records, rounded up to a power of two.
+  ShmRingProducer(const std::string& name, size_t capacity);
+  // Closes the stream.
+  ~ShmRingProducer();
+
+  // Copies |record| into the next slot, waiting while the ring is full.
+  void Publish(const lczero::V4TrainingData& record, int game_id);
+  // Tells consumers that no more records follow.
+  void Close();
+};
+
+// A record claimed by a consumer. |record| points into the shared memory
+// and stays valid until it is released.
+struct ShmRingRecord {
+  const lczero::V4TrainingData* record = nullptr;
+  int game_id = 0;
+  uint64_t position = 0;
+};
+
+class ShmRingConsumer : public ShmRing {
+ public:
+  // Opens the ring |name|, waiting up to |timeout_seconds| for the producer
+  // to create it. Throws when it doesn't show up.
+  explicit ShmRingConsumer(const std::string& name, int timeout_seconds = 60);
+
+  // Claims the next record, waiting for the producer if necessary. Returns
+  // false once the ring is closed and every record has been claimed.
+  bool Acquire(ShmRingRecord* record);
+  // Hands the slot of |record| back to the producer.
+  void Release(const ShmRingRecord& record);
+
+  // Removes the name of the ring. Mappings stay valid until they are gone.
+  void Unlink();
+};
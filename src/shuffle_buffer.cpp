@@ -0,0 +1,35 @@
+#include "shuffle_buffer.h"
+
+ShuffleBuffer::ShuffleBuffer(size_t capacity, uint64_t seed)
+    : capacity_(capacity < 1 ? 1 : capacity), random_(seed) {
+  records_.reserve(capacity_);
+  game_ids_.reserve(capacity_);
+}
+
+bool ShuffleBuffer::Insert(const lczero::V4TrainingData& record, int game_id,
+                           lczero::V4TrainingData* evicted,
+                           int* evicted_game_id) {
+  if (records_.size() < capacity_) {
+    records_.push_back(record);
+    game_ids_.push_back(game_id);
+    return false;
+  }
+  size_t idx = random_() % records_.size();
+  *evicted = records_[idx];
+  *evicted_game_id = game_ids_[idx];
+  records_[idx] = record;
+  game_ids_[idx] = game_id;
+  return true;
+}
+
+bool ShuffleBuffer::Extract(lczero::V4TrainingData* record, int* game_id) {
+  if (records_.empty()) return false;
+  size_t idx = random_() % records_.size();
+  *record = records_[idx];
+  *game_id = game_ids_[idx];
+  records_[idx] = records_.back();
+  game_ids_[idx] = game_ids_.back();
+  records_.pop_back();
+  game_ids_.pop_back();
+  return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "neural/writer.h"
+
+// Fixed size reservoir that decorrelates positions coming from the same game.
+// Once full, every inserted record evicts a uniformly chosen one, so records
+// leave the buffer in a random order mixed from many games. The sequence only
+// depends on the seed and the input, the output is reproducible.
+class ShuffleBuffer {
+ public:
+  ShuffleBuffer(size_t capacity, uint64_t seed);
+
+  // Adds |record| of game |game_id|. Returns true and fills |evicted| and
+  // |evicted_game_id| when a record had to be pushed out to make room.
+  bool Insert(const lczero::V4TrainingData& record, int game_id,
+              lczero::V4TrainingData* evicted, int* evicted_game_id);
+  // Removes a random record, returns false once the buffer is empty.
+  bool Extract(lczero::V4TrainingData* record, int* game_id);
+
+  size_t size() const { return records_.size(); }
+
+ private:
+  size_t capacity_;
+  std::vector<lczero::V4TrainingData> records_;
+  std::vector<int> game_ids_;
+  // mt19937_64 output is fully specified by the standard, unlike the
+  // distributions, so indices are taken with a plain modulo.
+  std::mt19937_64 random_;
+};
@@ -0,0 +1,204 @@
+#include "stage_timer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define HAS_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_RDTSC
+#endif
+
+#include "utils/exception.h"
+
+namespace {
+
+// Caps trace memory at roughly 24 MB per thread.
+const size_t kMaxTraceEventsPerThread = 1000000;
+
+struct TraceEvent {
+  uint64_t start;
+  uint64_t duration;
+  Stage stage;
+};
+
+struct ThreadStageData {
+  int thread_id = 0;
+  uint64_t ticks[kStageCount] = {};
+  uint64_t calls[kStageCount] = {};
+  uint64_t perf[kStageCount][kPerfCounterCount] = {};
+  bool perf_available[kPerfCounterCount] = {};
+  std::vector<TraceEvent> events;
+};
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ThreadStageData>> registry;
+bool trace_enabled = false;
+
+// Reference points to convert clock ticks to wall time.
+const uint64_t start_ticks = read_stage_clock();
+const std::chrono::steady_clock::time_point start_time =
+    std::chrono::steady_clock::now();
+
+ThreadStageData* thread_data() {
+  // Owned by the registry so the numbers outlive the thread.
+  thread_local ThreadStageData* data = nullptr;
+  if (!data) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.emplace_back(new ThreadStageData);
+    data = registry.back().get();
+    data->thread_id = static_cast<int>(registry.size());
+  }
+  return data;
+}
+
+double ticks_per_microsecond() {
+  uint64_t ticks = read_stage_clock() - start_ticks;
+  double us = std::chrono::duration<double, std::micro>(
+                  std::chrono::steady_clock::now() - start_time)
+                  .count();
+  return us > 0 ? ticks / us : 1.0;
+}
+
+}  // namespace
+
+bool stage_perf_counters_enabled = false;
+
+const char* stage_name(Stage stage) {
+  static const char* kNames[kStageCount] = {
+      "pgn_parse",  "san_to_move", "comment_parse", "legal_moves",
+      "policy",     "encode_planes", "reverse_bits", "play_move",
+      "score_to_q", "writer_wait", "shuffle",       "serialize",
+      "compress",   "write_file",
+  };
+  return kNames[static_cast<int>(stage)];
+}
+
+uint64_t read_stage_clock() {
+#if defined(HAS_RDTSC)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+ScopedStageTimer::~ScopedStageTimer() {
+  uint64_t end = read_stage_clock();
+  ThreadStageData* data = thread_data();
+  int idx = static_cast<int>(stage_);
+  data->ticks[idx] += end - start_;
+  data->calls[idx]++;
+  if (trace_enabled && data->events.size() < kMaxTraceEventsPerThread) {
+    data->events.push_back({start_, end - start_, stage_});
+  }
+  PerfCounts perf_end;
+  if (stage_perf_counters_enabled && read_thread_perf_counters(&perf_end)) {
+    for (int i = 0; i < kPerfCounterCount; ++i) {
+      if (!perf_start_.available[i] || !perf_end.available[i]) continue;
+      data->perf[idx][i] += perf_end.values[i] - perf_start_.values[i];
+      data->perf_available[i] = true;
+    }
+  }
+}
+
+void enable_stage_trace() { trace_enabled = true; }
+
+void enable_stage_perf_counters() { stage_perf_counters_enabled = true; }
+
+void print_stage_timers() {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  double tpus = ticks_per_microsecond();
+  uint64_t ticks[kStageCount] = {};
+  uint64_t calls[kStageCount] = {};
+  uint64_t perf[kStageCount][kPerfCounterCount] = {};
+  bool perf_available[kPerfCounterCount] = {};
+  for (const auto& data : registry) {
+    for (int i = 0; i < kStageCount; ++i) {
+      ticks[i] += data->ticks[i];
+      calls[i] += data->calls[i];
+      for (int j = 0; j < kPerfCounterCount; ++j) {
+        perf[i][j] += data->perf[i][j];
+      }
+    }
+    for (int j = 0; j < kPerfCounterCount; ++j) {
+      perf_available[j] = perf_available[j] || data->perf_available[j];
+    }
+  }
+  std::cout << "Stage timers (all threads):\n";
+  for (int i = 0; i < kStageCount; ++i) {
+    if (calls[i] == 0) continue;
+    char line[128];
+    std::snprintf(line, sizeof(line),
+                  "  %-14s %12.1f ms %12llu calls %10.0f ns/call\n",
+                  stage_name(static_cast<Stage>(i)), ticks[i] / tpus / 1000,
+                  static_cast<unsigned long long>(calls[i]),
+                  ticks[i] / tpus * 1000 / calls[i]);
+    std::cout << line;
+  }
+
+  if (stage_perf_counters_enabled) {
+    std::cout << "Stage performance counters (per call):\n";
+    char line[160];
+    int length = std::snprintf(line, sizeof(line), "  %-14s", "");
+    for (int j = 0; j < kPerfCounterCount; ++j) {
+      length += std::snprintf(line + length, sizeof(line) - length, " %14s",
+                              perf_counter_name(static_cast<PerfCounter>(j)));
+    }
+    std::snprintf(line + length, sizeof(line) - length, " %8s\n", "IPC");
+    std::cout << line;
+    const int kCycles = static_cast<int>(PerfCounter::CYCLES);
+    const int kInstructions = static_cast<int>(PerfCounter::INSTRUCTIONS);
+    for (int i = 0; i < kStageCount; ++i) {
+      if (calls[i] == 0) continue;
+      length = std::snprintf(line, sizeof(line), "  %-14s",
+                             stage_name(static_cast<Stage>(i)));
+      for (int j = 0; j < kPerfCounterCount; ++j) {
+        if (perf_available[j]) {
+          length += std::snprintf(line + length, sizeof(line) - length,
+                                  " %14.1f",
+                                  static_cast<double>(perf[i][j]) / calls[i]);
+        } else {
+          length += std::snprintf(line + length, sizeof(line) - length,
+                                  " %14s", "-");
+        }
+      }
+      double ipc = perf[i][kCycles] > 0
+                       ? static_cast<double>(perf[i][kInstructions]) /
+                             perf[i][kCycles]
+                       : 0.0;
+      std::snprintf(line + length, sizeof(line) - length, " %8.2f\n", ipc);
+      std::cout << line;
+    }
+  }
+  std::cout << std::flush;
+}
+
+void write_chrome_trace(const std::string& filename) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  FILE* f = std::fopen(filename.c_str(), "w");
+  if (!f) throw lczero::Exception("Cannot create trace file " + filename);
+  double tpus = ticks_per_microsecond();
+  std::fprintf(f, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (const auto& data : registry) {
+    for (const auto& event : data->events) {
+      std::fprintf(f,
+                   "%s{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\","
+                   "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                   first ? "" : ",\n", stage_name(event.stage),
+                   (event.start - start_ticks) / tpus, event.duration / tpus,
+                   data->thread_id);
+      first = false;
+    }
+  }
+  std::fprintf(f, "\n]}\n");
+  std::fclose(f);
+}
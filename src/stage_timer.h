@@ -0,0 +1,77 @@
+#pragma once
+
+// Low overhead per stage timers. Each thread accumulates time stamp counter
+// ticks per stage in thread local storage; nothing is shared on the hot path.
+// Building without TRAININGDATA_STAGE_TIMERS turns STAGE_TIMER() into nothing.
+
+#include <cstdint>
+#include <string>
+
+#include "perf_counters.h"
+
+enum class Stage {
+  PGN_PARSE,
+  SAN_TO_MOVE,
+  COMMENT_PARSE,
+  LEGAL_MOVES,
+  POLICY,
+  ENCODE_PLANES,
+  REVERSE_BITS,
+  PLAY_MOVE,
+  SCORE_TO_Q,
+  WRITER_WAIT,
+  SHUFFLE,
+  SERIALIZE,
+  COMPRESS,
+  WRITE_FILE,
+};
+const int kStageCount = 14;
+
+const char* stage_name(Stage stage);
+
+uint64_t read_stage_clock();
+
+// Set by enable_stage_perf_counters().
+extern bool stage_perf_counters_enabled;
+
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(Stage stage) : stage_(stage) {
+    if (stage_perf_counters_enabled) read_thread_perf_counters(&perf_start_);
+    start_ = read_stage_clock();
+  }
+  ~ScopedStageTimer();
+
+ private:
+  const Stage stage_;
+  uint64_t start_;
+  PerfCounts perf_start_;
+};
+
+#if defined(TRAININGDATA_STAGE_TIMERS)
+#define STAGE_TIMER_CONCAT2(a, b) a##b
+#define STAGE_TIMER_CONCAT(a, b) STAGE_TIMER_CONCAT2(a, b)
+#define STAGE_TIMER(stage) \
+  ScopedStageTimer STAGE_TIMER_CONCAT(stage_timer_, __LINE__)(stage)
+const bool kStageTimersEnabled = true;
+#else
+#define STAGE_TIMER(stage)
+const bool kStageTimersEnabled = false;
+#endif
+
+// Also record every timed scope, up to a per thread limit, for
+// write_chrome_trace().
+void enable_stage_trace();
+
+// Also count hardware events in every timed scope, see perf_counters.h.
+// Each scope then costs two read() calls, so times grow but the counts,
+// which only cover user space, stay accurate.
+void enable_stage_perf_counters();
+
+// Prints the time spent in every stage, summed over all threads. Call once
+// the worker threads are done.
+void print_stage_timers();
+
+// Writes the recorded scopes in Chrome trace_event JSON format, viewable in
+// chrome://tracing or Perfetto.
+void write_chrome_trace(const std::string& filename);
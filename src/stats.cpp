@@ -0,0 +1,140 @@
+#include "stats.h"
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+namespace {
+
+std::string format_count(double value) {
+  char buf[32];
+  if (value >= 1e9) {
+    std::snprintf(buf, sizeof(buf), "%.2fG", value / 1e9);
+  } else if (value >= 1e6) {
+    std::snprintf(buf, sizeof(buf), "%.2fM", value / 1e6);
+  } else if (value >= 1e4) {
+    std::snprintf(buf, sizeof(buf), "%.1fk", value / 1e3);
+  } else {
+    std::snprintf(buf, sizeof(buf), "%.0f", value);
+  }
+  return buf;
+}
+
+std::string format_bytes(double value) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.1f MB", value / (1024 * 1024));
+  return buf;
+}
+
+std::string format_duration(double seconds) {
+  long s = static_cast<long>(seconds);
+  char buf[32];
+  if (s >= 3600) {
+    std::snprintf(buf, sizeof(buf), "%ldh%02ldm", s / 3600, s / 60 % 60);
+  } else if (s >= 60) {
+    std::snprintf(buf, sizeof(buf), "%ldm%02lds", s / 60, s % 60);
+  } else {
+    std::snprintf(buf, sizeof(buf), "%lds", s);
+  }
+  return buf;
+}
+
+}  // namespace
+
+const char* reject_reason_name(RejectReason reason) {
+  switch (reason) {
+    case RejectReason::ILLEGAL_MOVE:
+      return "illegal move";
+    case RejectReason::NO_POSITIONS:
+      return "no positions";
+    case RejectReason::PARSE_ERROR:
+      return "parse error";
+  }
+  return "unknown";
+}
+
+uint64_t ConversionStats::GamesRejected() const {
+  uint64_t total = 0;
+  for (const auto& count : games_rejected) total += count;
+  return total;
+}
+
+ProgressReporter::ProgressReporter(const ConversionStats& stats,
+                                   uint64_t total_input_bytes,
+                                   int interval_seconds)
+    : stats_(stats),
+      total_input_bytes_(total_input_bytes),
+      interval_seconds_(interval_seconds),
+      start_(std::chrono::steady_clock::now()) {
+  if (interval_seconds_ > 0) thread_ = std::thread([this]() { Worker(); });
+}
+
+ProgressReporter::~ProgressReporter() {
+  if (thread_.joinable()) Finish();
+}
+
+double ProgressReporter::ElapsedSeconds() const {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start_)
+      .count();
+}
+
+void ProgressReporter::Worker() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, std::chrono::seconds(interval_seconds_),
+                       [this]() { return finished_; })) {
+    PrintProgress();
+  }
+}
+
+void ProgressReporter::PrintProgress() {
+  double elapsed = ElapsedSeconds();
+  double games = stats_.games_read;
+  double positions = stats_.positions_written;
+  double input = stats_.input_bytes;
+  std::string line = "[" + format_duration(elapsed) + "] games " +
+                     format_count(games) + " (" +
+                     format_count(games / elapsed) + "/s), rejected " +
+                     format_count(stats_.GamesRejected()) + ", positions " +
+                     format_count(positions) + " (" +
+                     format_count(positions / elapsed) + "/s), in " +
+                     format_bytes(input) + " (" +
+                     format_bytes(input / elapsed) + "/s), out " +
+                     format_bytes(stats_.output_bytes);
+  if (total_input_bytes_ > 0 && input > 0) {
+    double fraction = input / total_input_bytes_;
+    line += ", " + std::to_string(static_cast<int>(fraction * 100)) +
+            "%, ETA " + format_duration(elapsed / fraction - elapsed);
+  }
+  std::cout << line << std::endl;
+}
+
+void ProgressReporter::Finish() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+  }
+  cv_.notify_one();
+  if (thread_.joinable()) thread_.join();
+
+  double elapsed = ElapsedSeconds();
+  std::cout << "Finished in " << format_duration(elapsed) << "\n";
+  std::cout << "  games read:        " << stats_.games_read << "\n";
+  std::cout << "  games accepted:    " << stats_.games_accepted << "\n";
+  for (int i = 0; i < kRejectReasonCount; ++i) {
+    std::string name = reject_reason_name(static_cast<RejectReason>(i));
+    name += ":";
+    name.resize(17, ' ');
+    std::cout << "  rejected, " << name << stats_.games_rejected[i] << "\n";
+  }
+  if (stats_.moves_not_found > 0) {
+    std::cout << "  moves not found:   " << stats_.moves_not_found << "\n";
+  }
+  std::cout << "  positions written: " << stats_.positions_written << " ("
+            << format_count(stats_.positions_written / elapsed) << "/s)\n";
+  std::cout << "  files written:     " << stats_.files_written << "\n";
+  std::cout << "  input:             " << format_bytes(stats_.input_bytes)
+            << "\n";
+  std::cout << "  output:            " << format_bytes(stats_.output_bytes)
+            << std::endl;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+enum class RejectReason {
+  // The PGN contains a move polyglot can't parse or play.
+  ILLEGAL_MOVE,
+  // Nothing to write, e.g. no usable comments in fishtest mode.
+  NO_POSITIONS,
+  // polyglot reported a syntax error, the rest of the input is skipped.
+  PARSE_ERROR,
+};
+const int kRejectReasonCount = 3;
+
+const char* reject_reason_name(RejectReason reason);
+
+// Counters of a conversion run. Updated from the parsing and writer threads.
+struct ConversionStats {
+  std::atomic<uint64_t> games_read{0};
+  std::atomic<uint64_t> games_accepted{0};
+  std::atomic<uint64_t> games_rejected[kRejectReasonCount] = {};
+  std::atomic<uint64_t> positions_written{0};
+  // Moves without an lc0 counterpart among the legal moves. Their games are
+  // still converted.
+  std::atomic<uint64_t> moves_not_found{0};
+  std::atomic<uint64_t> files_written{0};
+  std::atomic<uint64_t> input_bytes{0};
+  std::atomic<uint64_t> output_bytes{0};
+
+  void Reject(RejectReason reason) {
+    games_rejected[static_cast<int>(reason)]++;
+  }
+  uint64_t GamesRejected() const;
+};
+
+// Prints a one line summary of |stats| every |interval_seconds| on a
+// background thread, with rates and an ETA derived from |total_input_bytes|.
+class ProgressReporter {
+ public:
+  ProgressReporter(const ConversionStats& stats, uint64_t total_input_bytes,
+                   int interval_seconds);
+  ~ProgressReporter();
+
+  // Stops the periodic output and prints the final summary.
+  void Finish();
+  // No progress is printed while the returned lock is held, which makes it
+  // safe to fork() with the reporter running.
+  std::unique_lock<std::mutex> Pause() {
+    return std::unique_lock<std::mutex>(mutex_);
+  }
+
+ private:
+  void Worker();
+  void PrintProgress();
+  double ElapsedSeconds() const;
+
+  const ConversionStats& stats_;
+  const uint64_t total_input_bytes_;
+  const int interval_seconds_;
+  const std::chrono::steady_clock::time_point start_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool finished_ = false;
+  std::thread thread_;
+};
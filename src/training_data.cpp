@@ -0,0 +1,122 @@
+#include "training_data.h"
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+#include "neural/encoder.h"
+#include "stage_timer.h"
+
+uint64_t resever_bits_in_bytes(uint64_t v) {
+  v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+  v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+  v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+  return v;
+}
+
+float convert_sf_score_to_win_probability(float score) {
+  return 2 / (1 + exp(-0.4 * score)) - 1;
+}
+
+std::string normalize_starting_fen(const std::string& fen) {
+  std::string starting_fen = fen;
+  std::istringstream fen_str(starting_fen);
+  std::string board;
+  std::string who_to_move;
+  std::string castlings;
+  std::string en_passant;
+  fen_str >> board >> who_to_move >> castlings >> en_passant;
+  if (fen_str.eof()) {
+    starting_fen.append(" 0 0");
+  }
+  return starting_fen;
+}
+
+void reset_position_history(const std::string& starting_fen,
+                            lczero::PositionHistory* history) {
+  lczero::ChessBoard starting_board;
+  starting_board.SetFromFen(starting_fen, nullptr, nullptr);
+  history->Reset(starting_board, 0, 0);
+}
+
+lczero::V4TrainingData get_v4_training_data(
+    lczero::GameResult game_result, const lczero::PositionHistory& history,
+    lczero::Move played_move, lczero::MoveList legal_moves, float Q) {
+  lczero::V4TrainingData result;
+
+  // Set version.
+  result.version = 4;
+
+  {
+    STAGE_TIMER(Stage::POLICY);
+    // Illegal moves will have "-1" probability
+    std::memset(result.probabilities, -1.0f, sizeof(result.probabilities));
+
+    // Populate legal moves with probability "0"
+    for (lczero::Move move : legal_moves) {
+      result.probabilities[move.as_nn_index()] = 0;
+    }
+
+    // Assign "1" (100%) to the move that was actually played
+    result.probabilities[played_move.as_nn_index()] = 1.0f;
+  }
+
+  // Populate planes.
+  lczero::InputPlanes planes;
+  {
+    STAGE_TIMER(Stage::ENCODE_PLANES);
+    planes =
+        EncodePositionForNN(history, 8, lczero::FillEmptyHistory::FEN_ONLY);
+  }
+  {
+    STAGE_TIMER(Stage::REVERSE_BITS);
+    int plane_idx = 0;
+    for (auto& plane : result.planes) {
+      plane = resever_bits_in_bytes(planes[plane_idx++].mask);
+    }
+  }
+
+  const auto& position = history.Last();
+  // Populate castlings.
+  result.castling_us_ooo =
+      position.CanCastle(lczero::Position::WE_CAN_OOO) ? 1 : 0;
+  result.castling_us_oo =
+      position.CanCastle(lczero::Position::WE_CAN_OO) ? 1 : 0;
+  result.castling_them_ooo =
+      position.CanCastle(lczero::Position::THEY_CAN_OOO) ? 1 : 0;
+  result.castling_them_oo =
+      position.CanCastle(lczero::Position::THEY_CAN_OO) ? 1 : 0;
+
+  // Other params.
+  result.side_to_move = position.IsBlackToMove() ? 1 : 0;
+  result.move_count = 0;
+  result.rule50_count = position.GetNoCaptureNoPawnPly();
+
+  // Game result.
+  if (game_result == lczero::GameResult::WHITE_WON) {
+    result.result = position.IsBlackToMove() ? -1 : 1;
+    result.root_d = result.best_d = 0.0f;
+  } else if (game_result == lczero::GameResult::BLACK_WON) {
+    result.result = position.IsBlackToMove() ? 1 : -1;
+    result.root_d = result.best_d = 0.0f;
+  } else {
+    result.result = 0;
+    result.root_d = result.best_d = 1.0f;
+  }
+
+  // Q for Q+Z training
+  result.root_q = result.best_q = position.IsBlackToMove() ? -Q : Q;
+
+  return result;
+}
+
+void set_training_data_q(const ScoreToQ& score_to_q, std::vector<float>* scores,
+                         std::vector<lczero::V4TrainingData>* records) {
+  STAGE_TIMER(Stage::SCORE_TO_Q);
+  score_to_q.Convert(scores->data(), scores->data(), scores->size());
+  for (size_t i = 0; i < records->size(); ++i) {
+    float Q = (*scores)[i];
+    auto& record = (*records)[i];
+    record.root_q = record.best_q = record.side_to_move ? -Q : Q;
+  }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+
+#include "chess/position.h"
+#include "neural/writer.h"
+#include "score_to_q.h"
+
+// Conversion steps that don't depend on the PGN parser, shared by the PGN
+// converter and the game stream expander.
+
+uint64_t resever_bits_in_bytes(uint64_t v);
+
+float convert_sf_score_to_win_probability(float score);
+
+// Completes |fen| with move counters when they are missing.
+std::string normalize_starting_fen(const std::string& fen);
+
+// Sets |history| to the (normalized) starting position of a game.
+void reset_position_history(const std::string& starting_fen,
+                            lczero::PositionHistory* history);
+
+lczero::V4TrainingData get_v4_training_data(
+    lczero::GameResult game_result, const lczero::PositionHistory& history,
+    lczero::Move played_move, lczero::MoveList legal_moves, float Q);
+
+// Sets root_q and best_q of |records| from the engine scores of their
+// positions (0 when there was none), converting all of them in one go.
+// |scores| is overwritten with the Q values.
+void set_training_data_q(const ScoreToQ& score_to_q, std::vector<float>* scores,
+                         std::vector<lczero::V4TrainingData>* records);
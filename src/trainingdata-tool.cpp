@@ -1,305 +1,71 @@
-#include "chess/position.h"
-#include "move.h"
-#include "move_do.h"
-#include "move_gen.h"
-#include "move_legal.h"
-#include "neural/encoder.h"
-#include "neural/network.h"
-#include "neural/writer.h"
+#include "async_writer.h"
+#include "chess/board.h"
 #include "pgn.h"
+#include "memory_budget.h"
+#include "multi_process.h"
+#include "parallel_files.h"
+#include "perf_counters.h"
+#include "pgn_converter.h"
 #include "polyglot_lib.h"
-#include "san.h"
-#include "square.h"
-#include "util.h"
+#include "server.h"
+#include "stage_timer.h"
+#include "stats.h"
+#include "utils/filesystem.h"
+#include "work_stealing.h"
 
-#include <cmath>
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
-#include <regex>
-#include <sstream>
-
-size_t max_games_per_directory = 10000;
-size_t max_games_to_convert = 10000000;
-
-struct Options {
-  bool verbose = false;
-  bool fishtest_mode = false;
-};
+#include <memory>
+#include <string>
+#include <vector>
 
 inline bool file_exists(const std::string& name) {
   std::ifstream f(name.c_str());
   return f.good();
 }
 
-uint64_t resever_bits_in_bytes(uint64_t v) {
-  v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
-  v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
-  v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
-  return v;
-}
-
-bool extract_fishtest_comment_score(const char* comment, float& Q) {
-  std::string s(comment);
-  static std::regex rgx("(-?\\d+\\.\\d+)/");
-  static std::regex rgx2("#(-?\\d+)/");
-  std::smatch matches;
-  if (std::regex_search(s, matches, rgx)) {
-    Q = std::stof(matches[1].str());
-    return true;
-  } else if (std::regex_search(s, matches, rgx2)) {
-    Q = matches[1].str().at(0) == '-' ? -128.0f : 128.0f;
-    return true;
-  }
+inline bool is_fifo(const std::string& name) {
+#if defined(_WIN32)
+  (void)name;
   return false;
+#else
+  struct stat st;
+  return stat(name.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+#endif
 }
 
-float convert_sf_score_to_win_probability(float score) {
-  return 2 / (1 + exp(-0.4 * score)) - 1;
-}
-
-lczero::Move poly_move_to_lc0_move(move_t move, board_t* board) {
-  lczero::BoardSquare from(square_rank(move_from(move)),
-                           square_file(move_from(move)));
-  lczero::BoardSquare to(square_rank(move_to(move)),
-                         square_file(move_to(move)));
-  lczero::Move m(from, to);
-
-  if (move_is_promote(move)) {
-    lczero::Move::Promotion lookup[5] = {
-        lczero::Move::Promotion::None,   lczero::Move::Promotion::Knight,
-        lczero::Move::Promotion::Bishop, lczero::Move::Promotion::Rook,
-        lczero::Move::Promotion::Queen,
-    };
-    auto prom = lookup[move >> 12];
-    m.SetPromotion(prom);
-  } else if (move_is_castle(move, board)) {
-    bool is_short_castle =
-        square_file(move_from(move)) < square_file(move_to(move));
-    int file_to = is_short_castle ? 6 : 2;
-    m.SetTo(lczero::BoardSquare(square_rank(move_to(move)), file_to));
-    m.SetCastling();
-  }
-
-  if (colour_is_black(board->turn)) {
-    m.Mirror();
-  }
-
-  return m;
-}
-
-lczero::V4TrainingData get_v4_training_data(
-    lczero::GameResult game_result, const lczero::PositionHistory& history,
-    lczero::Move played_move, lczero::MoveList legal_moves, float Q) {
-  lczero::V4TrainingData result;
-
-  // Set version.
-  result.version = 4;
-
-  // Illegal moves will have "-1" probability
-  std::memset(result.probabilities, -1.0f, sizeof(result.probabilities));
-
-  // Populate legal moves with probability "0"
-  for (lczero::Move move : legal_moves) {
-    result.probabilities[move.as_nn_index()] = 0;
-  }
-
-  // Assign "1" (100%) to the move that was actually played
-  result.probabilities[played_move.as_nn_index()] = 1.0f;
-
-  // Populate planes.
-  lczero::InputPlanes planes =
-      EncodePositionForNN(history, 8, lczero::FillEmptyHistory::FEN_ONLY);
-  int plane_idx = 0;
-  for (auto& plane : result.planes) {
-    plane = resever_bits_in_bytes(planes[plane_idx++].mask);
-  }
-
-  const auto& position = history.Last();
-  // Populate castlings.
-  result.castling_us_ooo =
-      position.CanCastle(lczero::Position::WE_CAN_OOO) ? 1 : 0;
-  result.castling_us_oo =
-      position.CanCastle(lczero::Position::WE_CAN_OO) ? 1 : 0;
-  result.castling_them_ooo =
-      position.CanCastle(lczero::Position::THEY_CAN_OOO) ? 1 : 0;
-  result.castling_them_oo =
-      position.CanCastle(lczero::Position::THEY_CAN_OO) ? 1 : 0;
-
-  // Other params.
-  result.side_to_move = position.IsBlackToMove() ? 1 : 0;
-  result.move_count = 0;
-  result.rule50_count = position.GetNoCaptureNoPawnPly();
-
-  // Game result.
-  if (game_result == lczero::GameResult::WHITE_WON) {
-    result.result = position.IsBlackToMove() ? -1 : 1;
-    result.root_d = result.best_d = 0.0f;
-  } else if (game_result == lczero::GameResult::BLACK_WON) {
-    result.result = position.IsBlackToMove() ? 1 : -1;
-    result.root_d = result.best_d = 0.0f;
-  } else {
-    result.result = 0;
-    result.root_d = result.best_d = 1.0f;
-  }
-
-  // Q for Q+Z training
-  result.root_q = result.best_q = position.IsBlackToMove() ? -Q : Q;
-
-  return result;
-}
-
-bool write_one_game_training_data(pgn_t* pgn, int game_id, Options options) {
-  std::vector<lczero::V4TrainingData> training_data;
-  lczero::ChessBoard starting_board;
-  std::string starting_fen =
-      std::strlen(pgn->fen) > 0 ? pgn->fen : lczero::ChessBoard::kStartposFen;
-
-  {
-    std::istringstream fen_str(starting_fen);
-    std::string board;
-    std::string who_to_move;
-    std::string castlings;
-    std::string en_passant;
-    int no_capture_halfmoves;
-    int total_moves;
-    fen_str >> board >> who_to_move >> castlings >> en_passant;
-    if (fen_str.eof()) {
-      starting_fen.append(" 0 0");
-    }
-  }
-
-  if (options.verbose) {
-    std::cout << "Started new game, starting FEN: \'" << starting_fen << "\'"
-              << std::endl;
-  }
-
-  starting_board.SetFromFen(starting_fen, nullptr, nullptr);
-
-  lczero::PositionHistory position_history;
-  position_history.Reset(starting_board, 0, 0);
-  board_t board[1];
-  board_from_fen(board, starting_fen.c_str());
-  char str[256];
-  lczero::TrainingDataWriter* writer = nullptr;
-
-  lczero::GameResult game_result;
-  if (options.verbose) {
-    std::cout << "Game result: " << pgn->result << std::endl;
-  }
-  if (my_string_equal(pgn->result, "1-0")) {
-    game_result = lczero::GameResult::WHITE_WON;
-  } else if (my_string_equal(pgn->result, "0-1")) {
-    game_result = lczero::GameResult::BLACK_WON;
-  } else {
-    game_result = lczero::GameResult::DRAW;
-  }
-
-  while (pgn_next_move(pgn, str, 256)) {
-    // Extract move from pgn
-    int move = move_from_san(str, board);
-    if (move == MoveNone || !move_is_legal(move, board)) {
-      std::cout << "illegal move \"" << str << "\" at line " << pgn->move_line
-                << ", column " << pgn->move_column << std::endl;
-      break;
-    }
-
-    if (options.verbose) {
-      move_to_san(move, board, str, 256);
-      std::cout << "Read move: " << str << std::endl;
-      if (pgn->last_read_comment[0]) {
-        std::cout << str << " pgn comment: " << pgn->last_read_comment
-                  << std::endl;
-      }
-    }
-
-    bool bad_move = false;
-    if (pgn->last_read_nag[0]) {
-      // If the move is bad or dubious, skip it.
-      // See https://en.wikipedia.org/wiki/Numeric_Annotation_Glyphs for PGN
-      // NAGs
-      if (pgn->last_read_nag[0] == '2' || pgn->last_read_nag[0] == '4' ||
-          pgn->last_read_nag[0] == '5' || pgn->last_read_nag[0] == '6') {
-        bad_move = true;
-      }
-    }
-
-    // Extract SF scores and convert to win probability
-    float Q = 0.0f;
-    if (pgn->last_read_comment[0]) {
-      float fishtest_score;
-      if (move_is_mate(move, board)) {
-        fishtest_score = position_history.Last().IsBlackToMove() ? -128.0f : 128.0f;
-      } else {
-        bool success = extract_fishtest_comment_score(pgn->last_read_comment,
-                                                     fishtest_score);
-        if (!success) {
-          break;  // Comment contained no "%eval"
-        }
-      }
-      Q = convert_sf_score_to_win_probability(fishtest_score);
-
-      // Since there is at least one move to write, initialize the writer
-      if (!writer) {
-        writer = new lczero::TrainingDataWriter(
-            game_id,
-            "supervised-" + std::to_string(game_id / max_games_per_directory));
-        game_id++;
-      }
-    } else if (options.fishtest_mode) {
-      // This game has no comments, skip it.
-      break;
-    }
-
-    // Convert move to lc0 format
-    lczero::Move lc0_move = poly_move_to_lc0_move(move, board);
-
-    bool found = false;
-    auto legal_moves = position_history.Last().GetBoard().GenerateLegalMoves();
-    for (auto legal : legal_moves) {
-      if (legal == lc0_move && legal.castling() == lc0_move.castling()) {
-        found = true;
-        break;
-      }
-    }
-    if (!found) {
-      std::cout << "Move not found: " << str << " " << game_id << " "
-                << square_file(move_to(move)) << std::endl;
-    }
-
-    if (!bad_move) {
-      // Generate training data
-      lczero::V4TrainingData chunk = get_v4_training_data(
-          game_result, position_history, lc0_move, legal_moves, Q);
-      writer->WriteChunk(chunk);
+int main(int argc, char* argv[]) {
+  // With "-o -" the records go to stdout, everything else to stderr.
+  for (int idx = 1; idx + 1 < argc; ++idx) {
+    if (0 == static_cast<std::string>("-o").compare(argv[idx]) &&
+        0 == static_cast<std::string>("-").compare(argv[idx + 1])) {
+      std::cout.rdbuf(std::cerr.rdbuf());
     }
-
-    // Execute move
-    position_history.Append(lc0_move);
-    move_do(board, move);
-  }
-
-  if (options.verbose) {
-    std::cout << "Game end." << std::endl;
-  }
-
-  // Fast-forward any remaining move
-  while (pgn_next_move(pgn, str, 256))
-    ;
-
-  if (writer) {
-    writer->Finalize();
-    delete writer;
   }
-  return writer;
-}
-
-int main(int argc, char* argv[]) {
   lczero::InitializeMagicBitboards();
   polyglot_init();
   int game_id = 0;
+  size_t max_games_per_directory = 10000;
+  size_t max_games_to_convert = 10000000;
   Options options;
-  for (size_t idx = 0; idx < argc; ++idx) {
+  WriterOptions writer_options;
+  int progress_interval = 10;
+  std::string trace_filename;
+  bool use_perf_counters = false;
+  size_t memory_budget_mb = 0;
+  int processes = 1;
+  std::string serve_socket;
+  int parallel_files = 1;
+  int threads = 1;
+  GameIdMode game_id_mode = GameIdMode::PER_FILE_RANGES;
+  std::vector<std::string> input_files;
+  for (int idx = 1; idx < argc; ++idx) {
     if (0 == static_cast<std::string>("-v").compare(argv[idx])) {
       std::cout << "Verbose mode ON" << std::endl;
       options.verbose = true;
@@ -309,27 +75,250 @@ int main(int argc, char* argv[]) {
       options.fishtest_mode = true;
     } else if (0 ==
                static_cast<std::string>("-games-per-dir").compare(argv[idx])) {
-      max_games_per_directory = std::atoi(argv[idx + 1]);
+      max_games_per_directory = std::atoi(argv[++idx]);
       std::cout << "Max games per directory set to: " << max_games_per_directory
                 << std::endl;
     } else if (0 == static_cast<std::string>("-max-games-to-convert")
                         .compare(argv[idx])) {
-      max_games_to_convert = std::atoi(argv[idx + 1]);
+      max_games_to_convert = std::atoi(argv[++idx]);
       std::cout << "Max games to convert set to: " << max_games_to_convert
                 << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-writer-buffers").compare(argv[idx])) {
+      writer_options.pool_size = std::atoi(argv[++idx]);
+      std::cout << "Writer buffers set to: " << writer_options.pool_size
+                << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-shuffle-buffer").compare(argv[idx])) {
+      writer_options.shuffle_buffer_size = std::atoi(argv[++idx]);
+      std::cout << "Shuffle buffer size set to: "
+                << writer_options.shuffle_buffer_size << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-shuffle-seed").compare(argv[idx])) {
+      writer_options.shuffle_seed = std::strtoull(argv[++idx], nullptr, 10);
+      std::cout << "Shuffle seed set to: " << writer_options.shuffle_seed
+                << std::endl;
+    } else if (0 == static_cast<std::string>("-records-per-chunk")
+                        .compare(argv[idx])) {
+      writer_options.records_per_chunk = std::atoi(argv[++idx]);
+      std::cout << "Records per chunk set to: "
+                << writer_options.records_per_chunk << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-output-format").compare(argv[idx])) {
+      std::string format = argv[++idx];
+      if (format == "compact") {
+        writer_options.format = OutputFormat::COMPACT;
+      } else if (format == "game-stream") {
+        writer_options.format = OutputFormat::GAME_STREAM;
+        options.game_stream = true;
+      } else if (format != "v4") {
+        std::cout << "Unknown output format: " << format << std::endl;
+        return 1;
+      }
+      std::cout << "Output format set to: " << format << std::endl;
+    } else if (0 == static_cast<std::string>("-q-scale").compare(argv[idx])) {
+      options.score_scale = std::atof(argv[++idx]);
+      std::cout << "Q scale set to: " << options.score_scale << std::endl;
+    } else if (0 == static_cast<std::string>("-progress").compare(argv[idx])) {
+      progress_interval = std::atoi(argv[++idx]);
+      std::cout << "Progress interval set to: " << progress_interval << "s"
+                << std::endl;
+    } else if (0 == static_cast<std::string>("-trace").compare(argv[idx])) {
+      trace_filename = argv[++idx];
+      if (kStageTimersEnabled) {
+        enable_stage_trace();
+        std::cout << "Writing stage trace to: " << trace_filename << std::endl;
+      } else {
+        std::cout << "Stage timers are not compiled in, build with "
+                     "TRAININGDATA_STAGE_TIMERS=ON to use -trace"
+                  << std::endl;
+      }
+    } else if (0 ==
+               static_cast<std::string>("-perf-counters").compare(argv[idx])) {
+      use_perf_counters = true;
+    } else if (0 ==
+               static_cast<std::string>("-memory-budget").compare(argv[idx])) {
+      memory_budget_mb = std::atoi(argv[++idx]);
+      std::cout << "Memory budget set to: " << memory_budget_mb << " MB"
+                << std::endl;
+    } else if (0 == static_cast<std::string>("-procs").compare(argv[idx])) {
+      processes = std::atoi(argv[++idx]);
+      std::cout << "Worker processes set to: " << processes << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-parallel-files").compare(argv[idx])) {
+      parallel_files = std::atoi(argv[++idx]);
+      std::cout << "Files converted in parallel set to: " << parallel_files
+                << std::endl;
+    } else if (0 == static_cast<std::string>("-threads").compare(argv[idx])) {
+      threads = std::atoi(argv[++idx]);
+      std::cout << "Conversion threads set to: " << threads << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-fast-game-ids").compare(argv[idx])) {
+      game_id_mode = GameIdMode::SHARED_COUNTER;
+    } else if (0 == static_cast<std::string>("-shm-ring").compare(argv[idx])) {
+      writer_options.shm_ring_name = argv[++idx];
+      std::cout << "Publishing records to shared memory ring: "
+                << writer_options.shm_ring_name << std::endl;
+    } else if (0 == static_cast<std::string>("-shm-ring-records")
+                        .compare(argv[idx])) {
+      writer_options.shm_ring_records = std::atoi(argv[++idx]);
+      std::cout << "Shared memory ring size set to: "
+                << writer_options.shm_ring_records << " records" << std::endl;
+    } else if (0 == static_cast<std::string>("-o").compare(argv[idx])) {
+      std::string output = argv[++idx];
+      if (output == "-" || is_fifo(output)) {
+        writer_options.output_stream = output;
+        std::cout << "Writing record stream to: "
+                  << (output == "-" ? "stdout" : output) << std::endl;
+      } else {
+        writer_options.output_directory = output;
+        std::cout << "Output directory set to: " << output << std::endl;
+      }
+    } else if (0 ==
+               static_cast<std::string>("-stream-gzip").compare(argv[idx])) {
+      writer_options.stream_gzip = true;
+    } else if (0 == static_cast<std::string>("-serve").compare(argv[idx]) ||
+               0 == static_cast<std::string>("--serve").compare(argv[idx])) {
+      serve_socket = argv[++idx];
+    } else if (0 == static_cast<std::string>("-manifest").compare(argv[idx])) {
+      writer_options.manifest_filename = argv[++idx];
+      std::cout << "Writing manifest to: " << writer_options.manifest_filename
+                << std::endl;
+    } else if (file_exists(argv[idx])) {
+      input_files.push_back(argv[idx]);
+    }
+  }
+  writer_options.games_per_directory = max_games_per_directory;
+  options.games_per_directory = max_games_per_directory;
+  ConversionStats stats;
+  writer_options.stats = &stats;
+  MemoryBudget memory_budget(memory_budget_mb << 20);
+  writer_options.memory_budget = &memory_budget;
+  if (options.game_stream && writer_options.shuffle_buffer_size > 0) {
+    std::cout << "Game streams can't be shuffled, expand them first."
+              << std::endl;
+    return 1;
+  }
+  if (!writer_options.output_stream.empty()) {
+    const char* conflict = nullptr;
+    if (options.game_stream) conflict = "-output-format game-stream";
+    if (processes > 1) conflict = "-procs";
+    if (!writer_options.shm_ring_name.empty()) conflict = "-shm-ring";
+    if (!writer_options.manifest_filename.empty()) conflict = "-manifest";
+    if (conflict) {
+      std::cout << "A record stream can't be combined with " << conflict
+                << std::endl;
+      return 1;
+    }
+  }
+  if (!writer_options.shm_ring_name.empty() &&
+      !writer_options.manifest_filename.empty()) {
+    // Nothing is written to files that a manifest could list.
+    std::cout << "A shared memory ring can't be combined with -manifest"
+              << std::endl;
+    return 1;
+  }
+  if ((parallel_files > 1) + (threads > 1) + (processes > 1) > 1) {
+    std::cout << "Only one of -parallel-files, -threads and -procs can be used"
+              << std::endl;
+    return 1;
+  }
+  if ((parallel_files > 1 || threads > 1) &&
+      writer_options.shuffle_buffer_size > 0) {
+    // Games reach the writer in an order that depends on thread timing, so
+    // the shuffled output wouldn't be reproducible for a fixed seed.
+    std::cout << "A shuffle buffer can't be combined with -parallel-files or "
+                 "-threads, expand game streams or shuffle the output instead"
+              << std::endl;
+    return 1;
+  }
+  if (parallel_files > 1 || threads > 1) {
+    // Every reader needs buffers of its own to keep going while the writer
+    // is busy.
+    writer_options.pool_size = std::max<size_t>(
+        writer_options.pool_size, 2 * std::max(parallel_files, threads));
+  }
+  if (!serve_socket.empty() && processes > 1) {
+    std::cout << "-serve can't be combined with -procs" << std::endl;
+    return 1;
+  }
+  uint64_t total_input_bytes = 0;
+  for (const auto& file : input_files) {
+    total_input_bytes += lczero::GetFileSize(file);
+  }
+  // Opened before any thread starts so that all of them are counted.
+  std::unique_ptr<ProcessPerfCounters> perf_counters;
+  if (use_perf_counters) {
+    perf_counters.reset(new ProcessPerfCounters);
+    if (!perf_counters->available()) {
+      std::cout << "Performance counters unavailable ("
+                << perf_counters->error()
+                << "), check /proc/sys/kernel/perf_event_paranoid"
+                << std::endl;
+      perf_counters.reset();
+    } else {
+      if (kStageTimersEnabled) enable_stage_perf_counters();
+      perf_counters->Start();
     }
   }
-  for (size_t idx = 1; idx < argc; ++idx) {
-    if (!file_exists(argv[idx])) continue;
-    pgn_t pgn[1];
-    if (options.verbose) {
-      std::cout << "Opening \'" << argv[idx] << "\'" << std::endl;
+
+  if (processes > 1) {
+    // The progress reporter is the only other thread of the parent, it is
+    // paused around fork().
+    MultiProcessConverter fan_out(input_files, max_games_to_convert);
+    std::cout << "Indexed " << fan_out.games() << " games in "
+              << fan_out.ranges() << " ranges" << std::endl;
+    ProgressReporter progress(fan_out.stats(), total_input_bytes,
+                              progress_interval);
+    size_t lost = fan_out.Run(processes, options, writer_options, &progress);
+    progress.Finish();
+    if (perf_counters) {
+      print_perf_counters(perf_counters->Stop(),
+                          fan_out.stats().positions_written);
     }
-    pgn_open(pgn, argv[idx]);
-    while (pgn_next_game(pgn) && game_id < max_games_to_convert) {
-      bool game_written = write_one_game_training_data(pgn, game_id, options);
-      if (game_written) game_id++;
+    if (lost > 0) {
+      std::cout << lost << " ranges of games were lost" << std::endl;
+      return 1;
     }
-    pgn_close(pgn);
+    return 0;
+  }
+
+  ProgressReporter progress(stats, total_input_bytes, progress_interval);
+
+  AsyncTrainingDataWriter writer(writer_options);
+  ScoreToQ score_to_q(logistic_score_model(options.score_scale));
+  if (threads > 1) {
+    WorkStealingConverter scheduler(input_files, max_games_to_convert, game_id);
+    game_id = scheduler.Run(threads, options, score_to_q, &writer, &stats);
+    std::cout << "Converted " << scheduler.blocks() << " blocks of games in "
+              << scheduler.batches() << " batches with " << scheduler.steals()
+              << " steals, " << 100 * scheduler.utilization()
+              << "% thread utilization" << std::endl;
+  } else if (parallel_files > 1) {
+    game_id = convert_pgn_files_parallel(
+        input_files, parallel_files, game_id_mode, options, score_to_q,
+        &writer, &stats, game_id, max_games_to_convert);
+  } else {
+    size_t games_left = max_games_to_convert;
+    for (const auto& file : input_files) {
+      games_left -= convert_pgn_file(file, options, score_to_q, &writer,
+                                     &stats, &game_id, games_left);
+    }
+  }
+  if (!serve_socket.empty()) {
+    // Input files, if any, are converted before serving starts.
+    ConversionServer server(serve_socket, options, &writer, &stats, game_id);
+    server.Run();
+  }
+  writer.Finish();
+  progress.Finish();
+  if (perf_counters) {
+    print_perf_counters(perf_counters->Stop(), stats.positions_written);
+  }
+  print_memory_report(memory_budget);
+  print_queue_report(writer.queue_metrics());
+  if (kStageTimersEnabled) {
+    print_stage_timers();
+    if (!trace_filename.empty()) write_chrome_trace(trace_filename);
   }
 }
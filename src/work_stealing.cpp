@@ -0,0 +1,184 @@
+#include "work_stealing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+struct WorkStealingConverter::WorkerDeque {
+  std::mutex mutex;
+  // Blocks [begin, end) left, guarded by |mutex|.
+  size_t begin = 0;
+  size_t end = 0;
+  // end - begin and the file of the block at the back, read without the
+  // lock to pick a victim.
+  std::atomic<size_t> remaining{0};
+  std::atomic<int> back_file{-1};
+  // Only touched by the owner.
+  uint64_t batches = 0;
+  uint64_t steals = 0;
+  double busy_seconds = 0;
+  // Keeps the deques of different workers on different cache lines.
+  char padding[64];
+};
+
+WorkStealingConverter::WorkStealingConverter(
+    const std::vector<std::string>& input_files, size_t max_games,
+    int first_game_id, size_t games_per_block)
+    : input_files_(input_files), first_game_id_(first_game_id) {
+  games_ = split_pgn_games(input_files_, max_games, games_per_block, &blocks_);
+}
+
+WorkStealingConverter::~WorkStealingConverter() = default;
+
+int WorkStealingConverter::Run(int threads, const Options& options,
+                               const ScoreToQ& score_to_q,
+                               AsyncTrainingDataWriter* writer,
+                               ConversionStats* stats) {
+  size_t workers = std::max(threads, 1);
+  deques_.clear();
+  for (size_t i = 0; i < workers; ++i) {
+    deques_.emplace_back(new WorkerDeque);
+    WorkerDeque& deque = *deques_.back();
+    deque.begin = blocks_.size() * i / workers;
+    deque.end = blocks_.size() * (i + 1) / workers;
+    deque.remaining = deque.end - deque.begin;
+    if (deque.end > deque.begin) deque.back_file = blocks_[deque.end - 1].file;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::atomic<bool> failed{false};
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  std::vector<std::thread> worker_threads;
+  for (size_t i = 0; i < workers; ++i) {
+    worker_threads.emplace_back([&, i]() {
+      try {
+        Worker(i, options, score_to_q, writer, stats);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) error = std::current_exception();
+        // Empties the deques so that the other workers stop soon.
+        for (auto& deque : deques_) {
+          std::lock_guard<std::mutex> deque_lock(deque->mutex);
+          deque->begin = deque->end;
+          deque->remaining = 0;
+        }
+        failed = true;
+      }
+    });
+  }
+  for (auto& thread : worker_threads) thread.join();
+  if (failed) std::rethrow_exception(error);
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  double busy_seconds = 0;
+  batches_ = 0;
+  steals_ = 0;
+  for (const auto& deque : deques_) {
+    busy_seconds += deque->busy_seconds;
+    batches_ += deque->batches;
+    steals_ += deque->steals;
+  }
+  utilization_ = seconds > 0 ? busy_seconds / (workers * seconds) : 1;
+  return first_game_id_ + static_cast<int>(games_);
+}
+
+void WorkStealingConverter::Worker(int worker, const Options& options,
+                                   const ScoreToQ& score_to_q,
+                                   AsyncTrainingDataWriter* writer,
+                                   ConversionStats* stats) {
+  WorkerDeque& own = *deques_[worker];
+  std::vector<char> text;
+  int last_file = -1;
+  for (;;) {
+    Batch batch;
+    if (!TakeBatch(worker, &batch)) {
+      if (!Steal(worker, last_file)) break;
+      continue;
+    }
+    auto start = std::chrono::steady_clock::now();
+    const GameRange& first = blocks_[batch.begin];
+    const GameRange& last = blocks_[batch.end - 1];
+    read_range(input_files_[first.file], first.begin, last.end, &text);
+    convert_range(text, first_game_id_ + first.first_game_id,
+                  last.first_game_id + last.games - first.first_game_id,
+                  options, score_to_q, writer, stats);
+    stats->input_bytes += last.end - first.begin;
+    last_file = first.file;
+    own.batches++;
+    own.busy_seconds += std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+  }
+}
+
+bool WorkStealingConverter::TakeBatch(int worker, Batch* batch) {
+  WorkerDeque& deque = *deques_[worker];
+  std::lock_guard<std::mutex> lock(deque.mutex);
+  size_t left = deque.end - deque.begin;
+  if (left == 0) return false;
+  // A quarter of what is left: thieves find plenty while there is a lot of
+  // work, and the tail is handed out block by block.
+  size_t size = std::min(std::max<size_t>(left / 4, 1), kMaxBatchBlocks);
+  // A batch is read in one go, so it stays within one file.
+  size_t end = deque.begin + 1;
+  while (end < deque.begin + size &&
+         blocks_[end].file == blocks_[deque.begin].file) {
+    end++;
+  }
+  batch->begin = deque.begin;
+  batch->end = end;
+  deque.begin = end;
+  deque.remaining = deque.end - deque.begin;
+  return true;
+}
+
+bool WorkStealingConverter::Steal(int thief, int last_file) {
+  WorkerDeque& own = *deques_[thief];
+  for (;;) {
+    // The worker with the most work left, or one in the file the thief just
+    // worked on if it has at least half as much.
+    int victim = -1;
+    size_t most = 0;
+    int local_victim = -1;
+    size_t most_local = 0;
+    for (size_t i = 0; i < deques_.size(); ++i) {
+      if (static_cast<int>(i) == thief) continue;
+      size_t left = deques_[i]->remaining.load(std::memory_order_relaxed);
+      if (left > most) {
+        most = left;
+        victim = i;
+      }
+      if (left > most_local && deques_[i]->back_file == last_file) {
+        most_local = left;
+        local_victim = i;
+      }
+    }
+    if (victim < 0) return false;
+    if (local_victim >= 0 && most_local * 2 >= most) victim = local_victim;
+
+    WorkerDeque& deque = *deques_[victim];
+    std::lock_guard<std::mutex> lock(deque.mutex);
+    size_t left = deque.end - deque.begin;
+    // Taken by its owner or another thief in the meantime.
+    if (left == 0) continue;
+    size_t stolen = (left + 1) / 2;
+    // The thief's deque is empty and only the thief fills it, so anyone else
+    // holding its lock lets go without waiting for another one.
+    std::lock_guard<std::mutex> own_lock(own.mutex);
+    own.begin = deque.end - stolen;
+    own.end = deque.end;
+    own.remaining = stolen;
+    own.back_file = blocks_[own.end - 1].file;
+    deque.end -= stolen;
+    deque.remaining = deque.end - deque.begin;
+    if (deque.end > deque.begin) deque.back_file = blocks_[deque.end - 1].file;
+    own.steals++;
+    return true;
+  }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+// Game level parallel conversion on threads of one process (-threads),
+// scheduled with work stealing. Games cost anything from a single ply to
+// hundreds of plies with a comment each, so any static split of the input
+// leaves threads idle at the end of a run.
+//
+// The input is split into blocks of a few consecutive games. Every worker
+// owns a deque of blocks, initially an equal contiguous share of them, and
+// takes batches from its front: large ones while it has plenty of work, to
+// read big sequential stretches of the file, shrinking to a single block as
+// its share runs out. A worker whose deque is empty steals the back half of
+// the deque of the worker with the most work left, preferring one in the
+// file it just worked on, so both keep reading contiguous parts of the
+// input. Work only moves between deques, a worker that finds all of them
+// empty is done.
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "async_writer.h"
+#include "multi_process.h"
+#include "pgn_converter.h"
+#include "score_to_q.h"
+#include "stats.h"
+
+// Games per block, the smallest unit of work.
+const size_t kGamesPerBlock = 16;
+// Largest batch a worker takes from its deque at once.
+const size_t kMaxBatchBlocks = 64;
+
+class WorkStealingConverter {
+ public:
+  // Indexes |input_files|, at most |max_games| games in total. Games are
+  // numbered by their position in the input, from |first_game_id| on.
+  WorkStealingConverter(const std::vector<std::string>& input_files,
+                        size_t max_games, int first_game_id = 0,
+                        size_t games_per_block = kGamesPerBlock);
+  ~WorkStealingConverter();
+
+  size_t games() const { return games_; }
+  size_t blocks() const { return blocks_.size(); }
+
+  // Converts all games on |threads| threads and returns the next free game
+  // id. Rejected games leave gaps.
+  int Run(int threads, const Options& options, const ScoreToQ& score_to_q,
+          AsyncTrainingDataWriter* writer, ConversionStats* stats);
+
+  // Scheduler totals of the last Run().
+  uint64_t batches() const { return batches_; }
+  uint64_t steals() const { return steals_; }
+  // Time the workers spent converting over the time they were running.
+  double utilization() const { return utilization_; }
+
+ private:
+  struct WorkerDeque;
+  // A range of blocks [begin, end) taken by a worker.
+  struct Batch {
+    size_t begin;
+    size_t end;
+  };
+
+  void Worker(int worker, const Options& options, const ScoreToQ& score_to_q,
+              AsyncTrainingDataWriter* writer, ConversionStats* stats);
+  // Takes the next batch from the front of the worker's own deque.
+  bool TakeBatch(int worker, Batch* batch);
+  // Moves the back half of another deque to the empty deque of |thief|.
+  // Returns false when there is nothing left to steal.
+  bool Steal(int thief, int last_file);
+
+  const std::vector<std::string> input_files_;
+  const int first_game_id_;
+  std::vector<GameRange> blocks_;
+  size_t games_ = 0;
+  std::vector<std::unique_ptr<WorkerDeque>> deques_;
+  uint64_t batches_ = 0;
+  uint64_t steals_ = 0;
+  double utilization_ = 0;
+};
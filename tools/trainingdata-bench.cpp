@@ -0,0 +1,300 @@
+// Benchmarks the conversion as a whole and its main stages separately, on a
+// fixed corpus: the test PGN and a large one made by repeating it. Every
+// benchmark is run several times and the median is reported, so numbers are
+// comparable between builds.
+
+#include "async_writer.h"
+#include "chess/board.h"
+#include "chunk_writer.h"
+#include "pgn.h"
+#include "pgn_converter.h"
+#include "polyglot_lib.h"
+#include "stats.h"
+#include "training_data.h"
+#include "util.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+
+#if defined(_WIN32)
+#include <direct.h>
+#define chdir _chdir
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+int64_t elapsed_ns(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                              start)
+      .count();
+}
+
+// A game as read from the corpus, ready to be replayed by every stage.
+struct BenchGame {
+  std::string starting_fen;
+  lczero::GameResult result = lczero::GameResult::DRAW;
+  std::vector<std::string> san;
+  std::vector<lczero::Move> moves;
+};
+
+std::vector<BenchGame> load_games(const std::string& filename) {
+  std::vector<BenchGame> games;
+  pgn_t pgn[1];
+  pgn_open(pgn, filename.c_str());
+  char str[256];
+  while (pgn_next_game(pgn)) {
+    BenchGame game;
+    game.starting_fen = normalize_starting_fen(
+        std::strlen(pgn->fen) > 0 ? pgn->fen
+                                  : lczero::ChessBoard::kStartposFen);
+    if (my_string_equal(pgn->result, "1-0")) {
+      game.result = lczero::GameResult::WHITE_WON;
+    } else if (my_string_equal(pgn->result, "0-1")) {
+      game.result = lczero::GameResult::BLACK_WON;
+    }
+    board_t board[1];
+    board_from_fen(board, game.starting_fen.c_str());
+    while (pgn_next_move(pgn, str, 256)) {
+      int move = move_from_san(str, board);
+      if (move == MoveNone || !move_is_legal(move, board)) break;
+      game.san.push_back(str);
+      game.moves.push_back(poly_move_to_lc0_move(move, board));
+      move_do(board, move);
+    }
+    while (pgn_next_move(pgn, str, 256))
+      ;
+    if (!game.moves.empty()) games.push_back(game);
+  }
+  pgn_close(pgn);
+  return games;
+}
+
+std::string make_large_corpus(const std::string& source, int copies,
+                              const std::string& filename) {
+  std::ifstream in(source, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  for (int i = 0; i < copies; ++i) {
+    out << data << "\n\n";
+  }
+  if (!out) throw lczero::Exception("Cannot write " + filename);
+  return filename;
+}
+
+struct Corpus {
+  std::string name;
+  std::string filename;
+  std::vector<BenchGame> games;
+  size_t positions = 0;
+};
+
+class Bench {
+ public:
+  Bench(const Corpus& corpus, int reps) : corpus_(corpus), reps_(reps) {
+    std::cout << std::endl
+              << "Corpus " << corpus_.name << ": " << corpus_.games.size()
+              << " games, " << corpus_.positions << " positions" << std::endl;
+    std::cout << std::left << std::setw(24) << "  benchmark" << std::right
+              << std::setw(12) << "median ms" << std::setw(16)
+              << "positions/s" << std::setw(14) << "ns/position"
+              << std::endl;
+  }
+
+  // |run| returns the nanoseconds it measured.
+  void Run(const std::string& name, const std::function<int64_t()>& run) {
+    std::vector<int64_t> times;
+    for (int i = 0; i < reps_; ++i) times.push_back(run());
+    Report(name, times);
+  }
+
+  void Report(const std::string& name, std::vector<int64_t> times) {
+    std::sort(times.begin(), times.end());
+    double ns = static_cast<double>(times[times.size() / 2]);
+    double positions = static_cast<double>(corpus_.positions);
+    std::cout << std::left << std::setw(24) << ("  " + name) << std::right
+              << std::fixed << std::setprecision(1) << std::setw(12)
+              << ns / 1e6 << std::setprecision(0) << std::setw(16)
+              << positions / ns * 1e9 << std::setprecision(1) << std::setw(14)
+              << ns / positions << std::endl;
+  }
+
+ private:
+  const Corpus& corpus_;
+  const int reps_;
+};
+
+void bench_corpus(const Corpus& corpus, int reps) {
+  Bench bench(corpus, reps);
+
+  bench.Run("end-to-end", [&]() {
+    Options options;
+    ConversionStats stats;
+    WriterOptions writer_options;
+    writer_options.games_per_directory = options.games_per_directory;
+    writer_options.stats = &stats;
+    ScoreToQ score_to_q(logistic_score_model(options.score_scale));
+    auto start = Clock::now();
+    {
+      AsyncTrainingDataWriter writer(writer_options);
+      int game_id = 0;
+      convert_pgn_file(corpus.filename, options, score_to_q, &writer, &stats,
+                       &game_id, SIZE_MAX);
+      writer.Finish();
+    }
+    return elapsed_ns(start);
+  });
+
+  bench.Run("pgn tokenize", [&]() {
+    auto start = Clock::now();
+    pgn_t pgn[1];
+    pgn_open(pgn, corpus.filename.c_str());
+    char str[256];
+    while (pgn_next_game(pgn)) {
+      while (pgn_next_move(pgn, str, 256))
+        ;
+    }
+    pgn_close(pgn);
+    return elapsed_ns(start);
+  });
+
+  bench.Run("san to move", [&]() {
+    auto start = Clock::now();
+    for (const auto& game : corpus.games) {
+      board_t board[1];
+      board_from_fen(board, game.starting_fen.c_str());
+      for (const auto& san : game.san) {
+        int move = move_from_san(san.c_str(), board);
+        if (move == MoveNone || !move_is_legal(move, board)) break;
+        move_do(board, move);
+      }
+    }
+    return elapsed_ns(start);
+  });
+
+  // The remaining stages only time the calls themselves, replaying the games
+  // in between is not part of the measurement.
+  std::vector<int64_t> training_data_times;
+  std::vector<int64_t> reverse_bits_times;
+  std::vector<int64_t> compress_times;
+  for (int i = 0; i < reps; ++i) {
+    int64_t training_data_ns = 0;
+    int64_t reverse_bits_ns = 0;
+    int64_t compress_ns = 0;
+    GzipCompressor compressor;
+    std::vector<lczero::V4TrainingData> records;
+    std::vector<char> compressed;
+    uint64_t sink = 0;
+    for (const auto& game : corpus.games) {
+      records.clear();
+      lczero::PositionHistory history;
+      reset_position_history(game.starting_fen, &history);
+      for (auto move : game.moves) {
+        auto legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+        auto start = Clock::now();
+        records.push_back(get_v4_training_data(game.result, history, move,
+                                               legal_moves, 0.0f));
+        training_data_ns += elapsed_ns(start);
+        history.Append(move);
+      }
+
+      auto start = Clock::now();
+      for (const auto& record : records) {
+        for (auto plane : record.planes) sink += resever_bits_in_bytes(plane);
+      }
+      reverse_bits_ns += elapsed_ns(start);
+
+      start = Clock::now();
+      compressor.Compress(records.data(),
+                          records.size() * sizeof(lczero::V4TrainingData),
+                          &compressed);
+      compress_ns += elapsed_ns(start);
+    }
+    // Keeps the bit reversal from being optimized away.
+    if (sink == 1) std::cout << "";
+    training_data_times.push_back(training_data_ns);
+    reverse_bits_times.push_back(reverse_bits_ns);
+    compress_times.push_back(compress_ns);
+  }
+  bench.Report("get_v4_training_data", training_data_times);
+  bench.Report("reverse bits", reverse_bits_times);
+  bench.Report("compress", compress_times);
+}
+
+Corpus load_corpus(const std::string& name, const std::string& filename) {
+  Corpus corpus;
+  corpus.name = name;
+  corpus.filename = filename;
+  corpus.games = load_games(filename);
+  for (const auto& game : corpus.games) corpus.positions += game.moves.size();
+  if (corpus.positions == 0) {
+    throw lczero::Exception("No positions in " + filename);
+  }
+  return corpus;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  lczero::InitializeMagicBitboards();
+  polyglot_init();
+  std::string corpus_filename = "test/2008_SCT_LadiesOpen.pgn";
+  std::string output_directory = "trainingdata-bench-output";
+  int large_copies = 20;
+  int reps = 5;
+  for (int idx = 1; idx < argc; ++idx) {
+    if (0 == static_cast<std::string>("-corpus").compare(argv[idx])) {
+      corpus_filename = argv[++idx];
+    } else if (0 ==
+               static_cast<std::string>("-output-dir").compare(argv[idx])) {
+      output_directory = argv[++idx];
+    } else if (0 ==
+               static_cast<std::string>("-large-copies").compare(argv[idx])) {
+      large_copies = std::atoi(argv[++idx]);
+    } else if (0 == static_cast<std::string>("-reps").compare(argv[idx])) {
+      reps = std::max(1, std::atoi(argv[++idx]));
+    } else {
+      std::cout << "Unknown option: " << argv[idx] << std::endl;
+      return 1;
+    }
+  }
+
+  // Conversion output goes to the current directory, keep it out of the way.
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd))) throw lczero::Exception("getcwd failed");
+  if (corpus_filename[0] != '/') {
+    corpus_filename = std::string(cwd) + "/" + corpus_filename;
+  }
+  lczero::CreateDirectory(output_directory);
+  if (chdir(output_directory.c_str()) != 0) {
+    throw lczero::Exception("Cannot enter " + output_directory);
+  }
+
+  std::cout << "Repetitions: " << reps << " (median reported)" << std::endl;
+  bench_corpus(load_corpus("small", corpus_filename), reps);
+  if (large_copies > 0) {
+    std::string large = make_large_corpus(corpus_filename, large_copies,
+                                          "bench-large.pgn");
+    bench_corpus(load_corpus("large (x" + std::to_string(large_copies) + ")",
+                             large),
+                 reps);
+    std::remove(large.c_str());
+  }
+}
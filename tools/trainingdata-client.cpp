@@ -0,0 +1,151 @@
+// Reference client of the conversion daemon (trainingdata-tool -serve).
+// Sends PGN files to the server and prints the counts and the round trip
+// time of every request.
+//
+//   trainingdata-tool -serve /tmp/td.sock &
+//   trainingdata-client /tmp/td.sock convert games.pgn
+//   trainingdata-client /tmp/td.sock write games.pgn more.pgn
+//   trainingdata-client /tmp/td.sock shutdown
+//
+// "convert" gets the records back, with -out they are appended to a file of
+// raw V4TrainingData records. "write" leaves them to the server's output.
+
+#include "server.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+uint64_t get_le64(const char* in) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i]))
+             << (8 * i);
+  }
+  return value;
+}
+
+int connect_to(const std::string& socket_path) {
+#if defined(_WIN32)
+  (void)socket_path;
+  return -1;
+#else
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) return -1;
+  std::strcpy(address.sun_path, socket_path.c_str());
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) !=
+      0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#endif
+}
+
+// Sends one request and reads the answer up to DONE or FAILED. Records are
+// appended to |out| if it is open. Returns false on FAILED.
+bool request(int fd, FrameType type, const std::vector<char>& pgn,
+             std::ofstream* out) {
+  auto start = std::chrono::steady_clock::now();
+  write_frame(fd, type, pgn.data(), pgn.size());
+  FrameType answer;
+  std::vector<char> payload;
+  uint64_t records = 0;
+  while (read_frame(fd, &answer, &payload)) {
+    if (answer == FrameType::RECORDS) {
+      records += payload.size() / sizeof(lczero::V4TrainingData);
+      if (out->is_open()) out->write(payload.data(), payload.size());
+      continue;
+    }
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    if (answer == FrameType::FAILED) {
+      std::cout << "Failed: " << std::string(payload.begin(), payload.end())
+                << " (" << ms << " ms)" << std::endl;
+      return false;
+    }
+    if (answer == FrameType::DONE && payload.size() == 32) {
+      std::cout << "Games read " << get_le64(payload.data()) << ", accepted "
+                << get_le64(payload.data() + 8) << ", rejected "
+                << get_le64(payload.data() + 16);
+      if (type == FrameType::CONVERT) std::cout << ", records " << records;
+      std::cout << " (" << ms << " ms)" << std::endl;
+      return true;
+    }
+    std::cout << "Unexpected answer from the server" << std::endl;
+    return false;
+  }
+  std::cout << "The server closed the connection" << std::endl;
+  return false;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string out_filename;
+  std::vector<std::string> arguments;
+  for (int idx = 1; idx < argc; ++idx) {
+    if (0 == static_cast<std::string>("-out").compare(argv[idx])) {
+      out_filename = argv[++idx];
+    } else {
+      arguments.push_back(argv[idx]);
+    }
+  }
+  if (arguments.size() < 2 ||
+      (arguments[1] != "shutdown" && arguments.size() < 3) ||
+      (arguments[1] != "convert" && arguments[1] != "write" &&
+       arguments[1] != "shutdown")) {
+    std::cout << "Usage: trainingdata-client [-out <file>] <socket> "
+                 "convert|write <pgn>...\n"
+                 "       trainingdata-client <socket> shutdown"
+              << std::endl;
+    return 1;
+  }
+  int fd = connect_to(arguments[0]);
+  if (fd < 0) {
+    std::cout << "Cannot connect to " << arguments[0] << std::endl;
+    return 1;
+  }
+  std::ofstream out;
+  if (!out_filename.empty()) {
+    out.open(out_filename, std::ios::binary | std::ios::app);
+  }
+
+  bool ok = true;
+  if (arguments[1] == "shutdown") {
+    ok = request(fd, FrameType::SHUTDOWN, {}, &out);
+  } else {
+    FrameType type = arguments[1] == "convert" ? FrameType::CONVERT
+                                               : FrameType::CONVERT_AND_WRITE;
+    for (size_t i = 2; i < arguments.size(); ++i) {
+      std::ifstream file(arguments[i], std::ios::binary);
+      std::vector<char> pgn((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+      std::cout << arguments[i] << ": ";
+      ok = request(fd, type, pgn, &out) && ok;
+    }
+  }
+#if !defined(_WIN32)
+  close(fd);
+#endif
+  return ok ? 0 : 1;
+}
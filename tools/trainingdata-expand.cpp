@@ -0,0 +1,108 @@
+// Expands game stream files written with "-output-format game-stream" into
+// training data, the same way trainingdata-tool would have written it.
+
+#include "async_writer.h"
+#include "chess/board.h"
+#include "game_stream.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main(int argc, char* argv[]) {
+  lczero::InitializeMagicBitboards();
+  int threads = std::thread::hardware_concurrency();
+  size_t max_games_per_directory = 10000;
+  double score_scale = kDefaultScoreScale;
+  size_t memory_budget_mb = 0;
+  WriterOptions writer_options;
+  std::vector<std::string> files;
+  for (int idx = 1; idx < argc; ++idx) {
+    if (0 == static_cast<std::string>("-threads").compare(argv[idx])) {
+      threads = std::atoi(argv[++idx]);
+      std::cout << "Threads set to: " << threads << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-games-per-dir").compare(argv[idx])) {
+      max_games_per_directory = std::atoi(argv[++idx]);
+      std::cout << "Max games per directory set to: " << max_games_per_directory
+                << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-output-format").compare(argv[idx])) {
+      std::string format = argv[++idx];
+      if (format == "compact") {
+        writer_options.format = OutputFormat::COMPACT;
+      } else if (format != "v4") {
+        std::cout << "Unknown output format: " << format << std::endl;
+        return 1;
+      }
+      std::cout << "Output format set to: " << format << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-shuffle-buffer").compare(argv[idx])) {
+      writer_options.shuffle_buffer_size = std::atoi(argv[++idx]);
+      std::cout << "Shuffle buffer size set to: "
+                << writer_options.shuffle_buffer_size << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-shuffle-seed").compare(argv[idx])) {
+      writer_options.shuffle_seed = std::strtoull(argv[++idx], nullptr, 10);
+      std::cout << "Shuffle seed set to: " << writer_options.shuffle_seed
+                << std::endl;
+    } else if (0 == static_cast<std::string>("-records-per-chunk")
+                        .compare(argv[idx])) {
+      writer_options.records_per_chunk = std::atoi(argv[++idx]);
+      std::cout << "Records per chunk set to: "
+                << writer_options.records_per_chunk << std::endl;
+    } else if (0 == static_cast<std::string>("-q-scale").compare(argv[idx])) {
+      score_scale = std::atof(argv[++idx]);
+      std::cout << "Q scale set to: " << score_scale << std::endl;
+    } else if (0 ==
+               static_cast<std::string>("-memory-budget").compare(argv[idx])) {
+      memory_budget_mb = std::atoi(argv[++idx]);
+      std::cout << "Memory budget set to: " << memory_budget_mb << " MB"
+                << std::endl;
+    } else if (0 == static_cast<std::string>("-manifest").compare(argv[idx])) {
+      writer_options.manifest_filename = argv[++idx];
+      std::cout << "Writing manifest to: " << writer_options.manifest_filename
+                << std::endl;
+    } else {
+      files.push_back(argv[idx]);
+    }
+  }
+  if (threads < 1) threads = 1;
+
+  writer_options.games_per_directory = max_games_per_directory;
+  // Every worker can have one game queued while it expands the next one.
+  writer_options.pool_size = 2 * threads;
+  MemoryBudget memory_budget(memory_budget_mb << 20);
+  writer_options.memory_budget = &memory_budget;
+  AsyncTrainingDataWriter writer(writer_options);
+  ScoreToQ score_to_q(logistic_score_model(score_scale));
+
+  std::vector<char> data;
+  std::vector<GameStream> games;
+  for (const auto& file : files) {
+    std::cout << "Expanding \'" << file << "\'" << std::endl;
+    read_game_stream_file(file, &data);
+    GameStreamReader reader(data.data(), data.size());
+    games.clear();
+    GameStream game;
+    while (reader.Next(&game)) games.push_back(game);
+
+    expand_game_streams(
+        games, score_to_q, threads,
+        [&](const GameStream& game,
+            const std::vector<lczero::V4TrainingData>& records) {
+          if (records.empty()) return;
+          GameRecords* out = writer.Acquire();
+          out->game_id = game.game_id;
+          out->directory =
+              "supervised-" +
+              std::to_string(game.game_id / max_games_per_directory);
+          out->records = records;
+          writer.Submit(out);
+        });
+  }
+  writer.Finish();
+  print_memory_report(memory_budget);
+}
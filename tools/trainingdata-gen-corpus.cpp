@@ -0,0 +1,375 @@
+// Writes large synthetic PGN corpora for scaling benchmarks. Games are random
+// legal games picked with the lc0 move generator and written as SAN through
+// polyglot, the same libraries the converter reads them back with. Every game
+// is generated from its own seed derived from -seed and its index, so the
+// output only depends on the options, not on the number of threads.
+
+#include "chess/board.h"
+#include "chess/position.h"
+#include "polyglot_lib.h"
+#include "training_data.h"
+#include "utils/exception.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct CorpusOptions {
+  uint64_t seed = 1;
+  // Game length in plies, normally distributed and clamped.
+  double plies_mean = 80;
+  double plies_stddev = 40;
+  int plies_min = 1;
+  int plies_max = 400;
+  // Probability that a move carries an eval comment.
+  double eval_rate = 0.5;
+  // Write fishtest "+0.45/20 1.2s" comments instead of Lichess "[%eval]".
+  bool fishtest_comments = false;
+  // Probability that a move has a NAG.
+  double nag_rate = 0.02;
+  // Probability that a game starts from a FEN reached by random plies.
+  double fen_rate = 0.05;
+  // Probability that a game has an illegal move or a comment without an
+  // evaluation, both of which the converter has to cope with.
+  double malformed_rate = 0.01;
+};
+
+// Appends tokens to PGN movetext, wrapping lines at 79 characters.
+class MoveText {
+ public:
+  void Append(const std::string& token) {
+    if (line_length_ > 0 && line_length_ + 1 + token.size() > 79) {
+      text_ += '\n';
+      line_length_ = 0;
+    } else if (line_length_ > 0) {
+      text_ += ' ';
+      line_length_++;
+    }
+    text_ += token;
+    line_length_ += token.size();
+  }
+
+  const std::string& text() const { return text_; }
+
+ private:
+  std::string text_;
+  size_t line_length_ = 0;
+};
+
+std::string format_score(std::mt19937_64* rng, bool fishtest) {
+  std::normal_distribution<double> score_distribution(0.0, 1.5);
+  char buffer[64];
+  double score = std::round(score_distribution(*rng) * 100.0) / 100.0;
+  if (fishtest) {
+    int depth = 10 + static_cast<int>((*rng)() % 20);
+    double seconds = static_cast<double>((*rng)() % 500) / 100.0;
+    std::snprintf(buffer, sizeof(buffer), "%+.2f/%d %.2fs", score, depth,
+                  seconds);
+  } else {
+    std::snprintf(buffer, sizeof(buffer), "[%%eval %.2f]", score);
+  }
+  return buffer;
+}
+
+class GameGenerator {
+ public:
+  GameGenerator(const CorpusOptions& options, uint64_t index)
+      : options_(options) {
+    std::seed_seq seed{static_cast<uint32_t>(options.seed),
+                       static_cast<uint32_t>(options.seed >> 32),
+                       static_cast<uint32_t>(index),
+                       static_cast<uint32_t>(index >> 32)};
+    rng_.seed(seed);
+    round_ = index + 1;
+  }
+
+  // Returns the game as PGN, followed by an empty line.
+  std::string Generate();
+
+ private:
+  bool Chance(double probability) {
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng_) <
+           probability;
+  }
+
+  void Reset(const std::string& fen);
+  // Picks a random legal move, or returns false when there is none.
+  bool PickMove(int* move, lczero::Move* lc0_move);
+  void Play(int move, lczero::Move lc0_move);
+
+  const CorpusOptions& options_;
+  std::mt19937_64 rng_;
+  uint64_t round_;
+  lczero::PositionHistory history_;
+  board_t board_[1];
+};
+
+void GameGenerator::Reset(const std::string& fen) {
+  reset_position_history(fen, &history_);
+  board_from_fen(board_, fen.c_str());
+}
+
+bool GameGenerator::PickMove(int* move, lczero::Move* lc0_move) {
+  auto legal_moves = history_.Last().GetBoard().GenerateLegalMoves();
+  if (legal_moves.empty()) return false;
+  *lc0_move = legal_moves[rng_() % legal_moves.size()];
+  // lc0 moves are from the side to move's point of view, polyglot wants
+  // them from White's.
+  lczero::Move uci_move = *lc0_move;
+  if (history_.Last().IsBlackToMove()) uci_move.Mirror();
+  *move = move_from_string(uci_move.as_string().c_str(), board_);
+  if (*move == MoveNone || !move_is_legal(*move, board_)) {
+    throw lczero::Exception("polyglot rejects lc0 move " +
+                            uci_move.as_string());
+  }
+  return true;
+}
+
+void GameGenerator::Play(int move, lczero::Move lc0_move) {
+  history_.Append(lc0_move);
+  move_do(board_, move);
+}
+
+std::string GameGenerator::Generate() {
+  std::string starting_fen = normalize_starting_fen(
+      lczero::ChessBoard::kStartposFen);
+  Reset(starting_fen);
+  bool fen_start = false;
+  int move;
+  lczero::Move lc0_move;
+  if (Chance(options_.fen_rate)) {
+    int plies = 4 + static_cast<int>(rng_() % 37);
+    for (int i = 0; i < plies && PickMove(&move, &lc0_move); ++i) {
+      Play(move, lc0_move);
+    }
+    char fen[256];
+    board_to_fen(board_, fen, sizeof(fen));
+    starting_fen = fen;
+    Reset(starting_fen);
+    fen_start = true;
+  }
+
+  std::normal_distribution<double> length_distribution(options_.plies_mean,
+                                                       options_.plies_stddev);
+  int plies = static_cast<int>(std::lround(length_distribution(rng_)));
+  plies = std::max(options_.plies_min, std::min(options_.plies_max, plies));
+  // Ply at which the game goes wrong, if it does.
+  int malformed_ply = -1;
+  if (Chance(options_.malformed_rate)) {
+    malformed_ply = static_cast<int>(rng_() % plies);
+  }
+
+  // The full move number is the last FEN field.
+  int move_number = std::atoi(
+      starting_fen.substr(starting_fen.find_last_of(' ') + 1).c_str());
+  if (move_number < 1) move_number = 1;
+  MoveText text;
+  std::vector<std::string> played;
+  char san[256];
+  const char* result = nullptr;
+  for (int ply = 0; ply < plies; ++ply) {
+    bool black = history_.Last().IsBlackToMove();
+    if (ply == malformed_ply) {
+      // A move played earlier is usually illegal now, otherwise fall back
+      // to a comment the converter can't find an evaluation in.
+      std::string bad_move;
+      for (auto it = played.rbegin(); it != played.rend(); ++it) {
+        int candidate = move_from_san(it->c_str(), board_);
+        if (candidate == MoveNone || !move_is_legal(candidate, board_)) {
+          bad_move = *it;
+          break;
+        }
+      }
+      text.Append(std::to_string(move_number) + (black ? "..." : "."));
+      if (!bad_move.empty()) {
+        text.Append(bad_move);
+      } else if (PickMove(&move, &lc0_move)) {
+        move_to_san(move, board_, san, sizeof(san));
+        text.Append(san);
+        text.Append("{book}");
+      }
+      break;
+    }
+    if (!PickMove(&move, &lc0_move)) {
+      if (history_.Last().GetBoard().IsUnderCheck()) {
+        result = black ? "1-0" : "0-1";
+      } else {
+        result = "1/2-1/2";
+      }
+      break;
+    }
+    move_to_san(move, board_, san, sizeof(san));
+    if (!black) {
+      text.Append(std::to_string(move_number) + ".");
+    } else if (ply == 0) {
+      text.Append(std::to_string(move_number) + "...");
+    }
+    text.Append(san);
+    if (Chance(options_.nag_rate)) {
+      text.Append("$" + std::to_string(1 + rng_() % 6));
+    }
+    if (Chance(options_.eval_rate)) {
+      text.Append("{" + format_score(&rng_, options_.fishtest_comments) +
+                  "}");
+    }
+    played.push_back(san);
+    Play(move, lc0_move);
+    if (black) move_number++;
+  }
+  if (!result) {
+    const char* kResults[] = {"1-0", "0-1", "1/2-1/2"};
+    result = kResults[rng_() % 3];
+  }
+  text.Append(result);
+
+  std::string pgn;
+  pgn += "[Event \"Synthetic\"]\n";
+  pgn += "[Site \"?\"]\n";
+  pgn += "[Date \"????.??.??\"]\n";
+  pgn += "[Round \"" + std::to_string(round_) + "\"]\n";
+  pgn += "[White \"?\"]\n";
+  pgn += "[Black \"?\"]\n";
+  pgn += "[Result \"" + std::string(result) + "\"]\n";
+  if (fen_start) {
+    pgn += "[FEN \"" + starting_fen + "\"]\n";
+    pgn += "[SetUp \"1\"]\n";
+  }
+  pgn += "\n" + text.text() + "\n\n";
+  return pgn;
+}
+
+// Parses sizes like "100M" or "10G".
+uint64_t parse_size(const std::string& size) {
+  char* end;
+  double value = std::strtod(size.c_str(), &end);
+  switch (*end) {
+    case 'k':
+    case 'K':
+      value *= 1e3;
+      break;
+    case 'm':
+    case 'M':
+      value *= 1e6;
+      break;
+    case 'g':
+    case 'G':
+      value *= 1e9;
+      break;
+    case 't':
+    case 'T':
+      value *= 1e12;
+      break;
+  }
+  return static_cast<uint64_t>(value);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  lczero::InitializeMagicBitboards();
+  polyglot_init();
+  CorpusOptions options;
+  std::string output_filename;
+  uint64_t max_games = UINT64_MAX;
+  uint64_t max_bytes = UINT64_MAX;
+  int threads = std::thread::hardware_concurrency();
+  for (int idx = 1; idx < argc; ++idx) {
+    if (0 == static_cast<std::string>("-output").compare(argv[idx])) {
+      output_filename = argv[++idx];
+    } else if (0 == static_cast<std::string>("-size").compare(argv[idx])) {
+      max_bytes = parse_size(argv[++idx]);
+    } else if (0 == static_cast<std::string>("-games").compare(argv[idx])) {
+      max_games = std::strtoull(argv[++idx], nullptr, 10);
+    } else if (0 == static_cast<std::string>("-seed").compare(argv[idx])) {
+      options.seed = std::strtoull(argv[++idx], nullptr, 10);
+    } else if (0 == static_cast<std::string>("-threads").compare(argv[idx])) {
+      threads = std::atoi(argv[++idx]);
+    } else if (0 ==
+               static_cast<std::string>("-plies-mean").compare(argv[idx])) {
+      options.plies_mean = std::atof(argv[++idx]);
+    } else if (0 ==
+               static_cast<std::string>("-plies-stddev").compare(argv[idx])) {
+      options.plies_stddev = std::atof(argv[++idx]);
+    } else if (0 == static_cast<std::string>("-plies-min").compare(argv[idx])) {
+      options.plies_min = std::max(1, std::atoi(argv[++idx]));
+    } else if (0 == static_cast<std::string>("-plies-max").compare(argv[idx])) {
+      options.plies_max = std::atoi(argv[++idx]);
+    } else if (0 == static_cast<std::string>("-eval-rate").compare(argv[idx])) {
+      options.eval_rate = std::atof(argv[++idx]);
+    } else if (0 == static_cast<std::string>("-fishtest-comments")
+                        .compare(argv[idx])) {
+      options.fishtest_comments = true;
+    } else if (0 == static_cast<std::string>("-nag-rate").compare(argv[idx])) {
+      options.nag_rate = std::atof(argv[++idx]);
+    } else if (0 == static_cast<std::string>("-fen-rate").compare(argv[idx])) {
+      options.fen_rate = std::atof(argv[++idx]);
+    } else if (0 ==
+               static_cast<std::string>("-malformed-rate").compare(argv[idx])) {
+      options.malformed_rate = std::atof(argv[++idx]);
+    } else {
+      std::cout << "Unknown option: " << argv[idx] << std::endl;
+      return 1;
+    }
+  }
+  if (output_filename.empty() ||
+      (max_games == UINT64_MAX && max_bytes == UINT64_MAX)) {
+    std::cout << "Usage: trainingdata-gen-corpus -output <file> "
+                 "(-size <bytes[K|M|G|T]> | -games <n>) [options]"
+              << std::endl;
+    return 1;
+  }
+  if (threads < 1) threads = 1;
+  options.plies_max = std::max(options.plies_min, options.plies_max);
+
+  FILE* output = std::fopen(output_filename.c_str(), "wb");
+  if (!output) throw lczero::Exception("Cannot create " + output_filename);
+
+  // Games are generated in blocks, one per thread, and written in order.
+  const uint64_t kBlockGames = 256;
+  std::vector<std::vector<std::string>> blocks(threads);
+  uint64_t games = 0;
+  uint64_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (games < max_games && bytes < max_bytes) {
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t]() {
+        blocks[t].clear();
+        uint64_t first = games + t * kBlockGames;
+        for (uint64_t i = first; i < first + kBlockGames; ++i) {
+          blocks[t].push_back(GameGenerator(options, i).Generate());
+        }
+      });
+    }
+    for (auto& worker : workers) worker.join();
+    for (const auto& block : blocks) {
+      for (const auto& game : block) {
+        if (games >= max_games || bytes >= max_bytes) break;
+        if (std::fwrite(game.data(), 1, game.size(), output) != game.size()) {
+          throw lczero::Exception("Cannot write " + output_filename);
+        }
+        games++;
+        bytes += game.size();
+      }
+    }
+  }
+  if (std::fclose(output) != 0) {
+    throw lczero::Exception("Cannot write " + output_filename);
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cout << "Wrote " << games << " games, " << bytes << " bytes to "
+            << output_filename << " in " << seconds << "s" << std::endl;
+}
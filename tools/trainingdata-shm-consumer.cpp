@@ -0,0 +1,117 @@
+// Reference consumer of the shared memory ring output of trainingdata-tool
+// (-shm-ring). Reads every record of the given rings in place and prints the
+// number of records and an order independent checksum. The checksum only
+// depends on the input and the conversion options, not on the number of
+// consumers or -procs workers, so a trainer's data loader can be compared
+// with it.
+//
+//   trainingdata-tool -shm-ring /td games.pgn &
+//   trainingdata-shm-consumer /td
+//
+// With -procs N the rings are named /td.0 to /td.<N-1>.
+
+#include "shm_ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+uint64_t fnv1a(const void* data, size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+struct ConsumerTotals {
+  std::atomic<uint64_t> records{0};
+  std::atomic<uint64_t> checksum{0};
+};
+
+// Consumes |ring| until it is closed and drained.
+void consume(ShmRingConsumer* ring, int delay_us, ConsumerTotals* totals) {
+  ShmRingRecord record;
+  uint64_t records = 0;
+  uint64_t checksum = 0;
+  while (ring->Acquire(&record)) {
+    checksum += fnv1a(record.record, sizeof(*record.record));
+    if (delay_us > 0) {
+      // Stands in for the time a trainer spends on a position.
+      std::this_thread::sleep_for(std::chrono::microseconds(delay_us));
+    }
+    ring->Release(record);
+    records++;
+  }
+  totals->records += records;
+  totals->checksum += checksum;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int threads = 1;
+  int timeout_seconds = 60;
+  int delay_us = 0;
+  bool keep = false;
+  std::vector<std::string> names;
+  for (int idx = 1; idx < argc; ++idx) {
+    if (0 == static_cast<std::string>("-threads").compare(argv[idx])) {
+      threads = std::atoi(argv[++idx]);
+    } else if (0 == static_cast<std::string>("-timeout").compare(argv[idx])) {
+      timeout_seconds = std::atoi(argv[++idx]);
+    } else if (0 == static_cast<std::string>("-delay-us").compare(argv[idx])) {
+      delay_us = std::atoi(argv[++idx]);
+    } else if (0 == static_cast<std::string>("-keep").compare(argv[idx])) {
+      keep = true;
+    } else {
+      names.push_back(argv[idx]);
+    }
+  }
+  if (names.empty()) {
+    std::cout << "Usage: trainingdata-shm-consumer [-threads <n>] "
+                 "[-timeout <seconds>] [-delay-us <us>] [-keep] <ring>..."
+              << std::endl;
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::unique_ptr<ShmRingConsumer>> rings;
+  for (const auto& name : names) {
+    rings.emplace_back(new ShmRingConsumer(name, timeout_seconds));
+    std::cout << "Opened " << name << " with " << rings.back()->capacity()
+              << " slots" << std::endl;
+  }
+  ConsumerTotals totals;
+  std::vector<std::thread> consumers;
+  for (auto& ring : rings) {
+    for (int i = 0; i < threads; ++i) {
+      consumers.emplace_back(consume, ring.get(), delay_us, &totals);
+    }
+  }
+  for (auto& consumer : consumers) consumer.join();
+  if (!keep) {
+    for (auto& ring : rings) ring->Unlink();
+  }
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  char checksum[32];
+  std::snprintf(checksum, sizeof(checksum), "%016llx",
+                static_cast<unsigned long long>(totals.checksum));
+  std::cout << "Consumed " << totals.records << " records in " << seconds
+            << "s (" << static_cast<uint64_t>(totals.records / seconds)
+            << " records/s), checksum " << checksum << std::endl;
+}
@@ -0,0 +1,920 @@
+// Checks that the converter output hasn't changed. The bundled PGNs are
+// converted with the reference settings and the decoded records are hashed
+// field by field and compared with checked-in golden hashes. Every other
+// output mode is then converted too, read back and compared record by record
+// with the reference output, together with the fast paths that have a
+// reference implementation (eval comments, also generated ones, and the score
+// to Q table); Lichess eval comments are checked against expected scores.
+// Finally many parsers run concurrently, mixed with malformed PGN, and must
+// all reproduce the reference output, and the parallel modes and the queues
+// between the pipeline stages must hand over every game exactly once.
+//
+// Exits with 1 on any mismatch. Run it from the repository root.
+
+#include "async_writer.h"
+#include "chess/board.h"
+#include "chunk_writer.h"
+#include "compact_training_data.h"
+#include "converter.h"
+#include "eval_comment.h"
+#include "game_stream.h"
+#include "mpmc_queue.h"
+#include "parallel_files.h"
+#include "pgn.h"
+#include "pgn_converter.h"
+#include "polyglot_lib.h"
+#include "record_check.h"
+#include "training_data.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "work_stealing.h"
+
+#if defined(_WIN32)
+#include <direct.h>
+#define chdir _chdir
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Mode {
+  const char* name;
+  OutputFormat format;
+  size_t pool_size;
+  size_t shuffle_buffer_size;
+};
+
+// The first mode is the reference every other one is compared with.
+const Mode kModes[] = {
+    {"v4", OutputFormat::V4, 2, 0},
+    {"v4-writer-buffers-8", OutputFormat::V4, 8, 0},
+    {"compact", OutputFormat::COMPACT, 2, 0},
+    {"game-stream", OutputFormat::GAME_STREAM, 2, 0},
+    {"shuffled", OutputFormat::V4, 2, 4096},
+};
+
+const char kManifestFilename[] = "manifest.jsonl";
+
+std::string basename(const std::string& path) {
+  size_t slash = path.find_last_of('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Reads back every file listed in the manifest, in the order they were
+// written, and decodes them into V4 records. The games of every file go to
+// |game_ids| when set.
+void read_output(const Mode& mode, const ScoreToQ& score_to_q,
+                 std::vector<lczero::V4TrainingData>* records,
+                 std::vector<int>* game_ids = nullptr) {
+  std::ifstream manifest(kManifestFilename);
+  std::string line;
+  std::vector<char> data;
+  std::vector<lczero::V4TrainingData> game_records;
+  std::vector<float> scores;
+  const std::string kPathKey = "\"path\":\"";
+  const std::string kGamesKey = "\"games\":[";
+  while (std::getline(manifest, line)) {
+    size_t start = line.find(kPathKey);
+    if (start == std::string::npos) continue;
+    size_t games = line.find(kGamesKey);
+    if (game_ids && games != std::string::npos) {
+      std::istringstream ids(line.substr(games + kGamesKey.size()));
+      int id;
+      while (ids >> id) {
+        game_ids->push_back(id);
+        if (ids.get() != ',') break;
+      }
+    }
+    std::string path;
+    for (size_t i = start + kPathKey.size(); i < line.size() && line[i] != '"';
+         ++i) {
+      // The manifest escapes '"' and '\\' in paths.
+      if (line[i] == '\\') ++i;
+      path += line[i];
+    }
+    read_compressed_file(path, &data);
+    if (mode.format == OutputFormat::GAME_STREAM) {
+      GameStreamReader reader(data.data(), data.size());
+      GameStream game;
+      while (reader.Next(&game)) {
+        expand_game_stream(game, score_to_q, &game_records, &scores);
+        records->insert(records->end(), game_records.begin(),
+                        game_records.end());
+      }
+    } else if (mode.format == OutputFormat::COMPACT) {
+      if (data.size() % sizeof(CompactTrainingData) != 0) {
+        throw lczero::Exception("Truncated compact file " + path);
+      }
+      size_t count = data.size() / sizeof(CompactTrainingData);
+      size_t offset = records->size();
+      records->resize(offset + count);
+      expand_compact_training_data(
+          reinterpret_cast<const CompactTrainingData*>(data.data()), count,
+          records->data() + offset);
+    } else {
+      if (data.size() % sizeof(lczero::V4TrainingData) != 0) {
+        throw lczero::Exception("Truncated training data file " + path);
+      }
+      size_t offset = records->size();
+      records->resize(offset + data.size() / sizeof(lczero::V4TrainingData));
+      std::memcpy(records->data() + offset, data.data(), data.size());
+    }
+  }
+}
+
+// Converts with |mode|'s writer, games are handed to it by the function.
+using ConvertFunction =
+    std::function<void(const Options& options, const ScoreToQ& score_to_q,
+                       AsyncTrainingDataWriter* writer,
+                       ConversionStats* stats)>;
+
+// Runs |run| in |mode| inside |directory| and returns the records as they
+// ended up on disk, and the games of every file when |game_ids| is set.
+std::vector<lczero::V4TrainingData> convert_with(
+    const Mode& mode, const std::string& directory, const ConvertFunction& run,
+    size_t games_per_directory = Options().games_per_directory,
+    std::vector<int>* game_ids = nullptr) {
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd))) throw lczero::Exception("getcwd failed");
+  lczero::CreateDirectory(directory);
+  if (chdir(directory.c_str()) != 0) {
+    throw lczero::Exception("Cannot enter " + directory);
+  }
+
+  Options options;
+  options.game_stream = mode.format == OutputFormat::GAME_STREAM;
+  options.games_per_directory = games_per_directory;
+  ConversionStats stats;
+  WriterOptions writer_options;
+  writer_options.format = mode.format;
+  writer_options.pool_size = mode.pool_size;
+  writer_options.shuffle_buffer_size = mode.shuffle_buffer_size;
+  writer_options.games_per_directory = options.games_per_directory;
+  writer_options.manifest_filename = kManifestFilename;
+  writer_options.stats = &stats;
+  ScoreToQ score_to_q(logistic_score_model(options.score_scale));
+  {
+    AsyncTrainingDataWriter writer(writer_options);
+    run(options, score_to_q, &writer, &stats);
+    writer.Finish();
+  }
+  std::vector<lczero::V4TrainingData> records;
+  read_output(mode, score_to_q, &records, game_ids);
+
+  if (chdir(cwd) != 0) {
+    throw lczero::Exception("Cannot go back to " + std::string(cwd));
+  }
+  return records;
+}
+
+// Converts |pgn_filename| in |mode| inside |directory| like a plain run of
+// trainingdata-tool.
+std::vector<lczero::V4TrainingData> convert(const std::string& pgn_filename,
+                                            const Mode& mode,
+                                            const std::string& directory) {
+  return convert_with(
+      mode, directory,
+      [&](const Options& options, const ScoreToQ& score_to_q,
+          AsyncTrainingDataWriter* writer, ConversionStats* stats) {
+        int game_id = 0;
+        convert_pgn_file(pgn_filename, options, score_to_q, writer, stats,
+                         &game_id, SIZE_MAX);
+      });
+}
+
+std::string read_text_file(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+}
+
+// The same conversion through the in-process Converter, from memory.
+std::vector<lczero::V4TrainingData> convert_in_process(const std::string& pgn) {
+  std::vector<lczero::V4TrainingData> records;
+  Converter converter;
+  converter.Convert(pgn.data(), pgn.size(),
+                    [&](const TrainingDataBatch& batch) {
+                      records.insert(records.end(), batch.records.begin(),
+                                     batch.records.end());
+                    });
+  return records;
+}
+
+// The field arrays of Converter::Next(TrainingDataColumns*) against the
+// |reference| records, in batches small enough to split the input many
+// times. The policy index must be the one move with probability 1.
+bool check_columns(const std::string& pgn,
+                   const std::vector<lczero::V4TrainingData>& reference) {
+  Converter converter(Options(), 7);
+  converter.Open(pgn.data(), pgn.size());
+  TrainingDataColumns columns;
+  size_t row = 0;
+  size_t mismatches = 0;
+  int last_game_id = -1;
+  while (converter.Next(&columns)) {
+    for (size_t i = 0; i < columns.size; ++i, ++row) {
+      if (row >= reference.size()) continue;
+      const auto& record = reference[row];
+      int policy_index = -1;
+      for (int j = 0; j < 1858; ++j) {
+        if (record.probabilities[j] == 1.0f) {
+          policy_index = j;
+          break;
+        }
+      }
+      const uint8_t* castling = &columns.castling[4 * i];
+      bool same =
+          std::memcmp(&columns.planes[104 * i], record.planes,
+                      sizeof(record.planes)) == 0 &&
+          columns.policy_index[i] == policy_index &&
+          castling[0] == record.castling_us_ooo &&
+          castling[1] == record.castling_us_oo &&
+          castling[2] == record.castling_them_ooo &&
+          castling[3] == record.castling_them_oo &&
+          columns.side_to_move[i] == record.side_to_move &&
+          columns.rule50_count[i] == record.rule50_count &&
+          columns.result[i] == record.result &&
+          std::memcmp(&columns.q[i], &record.root_q, sizeof(float)) == 0 &&
+          std::memcmp(&columns.d[i], &record.root_d, sizeof(float)) == 0 &&
+          columns.game_ids[i] >= last_game_id &&
+          columns.game_ids[i] <= last_game_id + 1;
+      last_game_id = columns.game_ids[i];
+      if (!same && mismatches++ < 10) {
+        std::cout << "FAIL columns: record " << row << " differs" << std::endl;
+      }
+    }
+  }
+  if (row != reference.size()) {
+    std::cout << "FAIL columns: " << row << " records, reference has "
+              << reference.size() << std::endl;
+    return false;
+  }
+  if (mismatches > 0) {
+    std::cout << "FAIL columns: " << mismatches << " records differ"
+              << std::endl;
+    return false;
+  }
+  std::cout << "ok   columns: " << row << " records" << std::endl;
+  return true;
+}
+
+bool record_less(const lczero::V4TrainingData& a,
+                 const lczero::V4TrainingData& b) {
+  return std::memcmp(&a, &b, sizeof(a)) < 0;
+}
+
+// Compares |records| with |reference|. Shuffled output is compared as a
+// multiset.
+bool compare_records(const std::string& name,
+                     std::vector<lczero::V4TrainingData> reference,
+                     std::vector<lczero::V4TrainingData> records,
+                     bool ordered) {
+  if (records.size() != reference.size()) {
+    std::cout << "FAIL " << name << ": " << records.size()
+              << " records, reference has " << reference.size() << std::endl;
+    return false;
+  }
+  if (!ordered) {
+    std::sort(reference.begin(), reference.end(), record_less);
+    std::sort(records.begin(), records.end(), record_less);
+  }
+  const size_t kMaxReported = 10;
+  size_t mismatches = 0;
+  for (size_t i = 0; i < records.size(); ++i) {
+    int field = training_data_difference(reference[i], records[i]);
+    if (field < 0) continue;
+    if (mismatches++ < kMaxReported) {
+      std::cout << "FAIL " << name << ": record " << i << " differs in "
+                << training_data_field_name(field) << std::endl;
+    }
+  }
+  if (mismatches > 0) {
+    std::cout << "FAIL " << name << ": " << mismatches << " of "
+              << records.size() << " records differ" << std::endl;
+    return false;
+  }
+  std::cout << "ok   " << name << ": " << records.size() << " records"
+            << std::endl;
+  return true;
+}
+
+// Inputs polyglot can't parse. Whether a given one is a fatal error depends on
+// polyglot, but none of them may take the process down.
+const char* const kMalformedPgn[] = {
+    "[Event \"unterminated comment\"]\n\n1. e4 {e5 2. Nf3 *\n",
+    "[Event \"unterminated tag\n\n1. e4 e5 *\n",
+    "[Event \"control character\"]\n\n1. e4 \x01 e5 *\n",
+    "[Event \"bad token\"]\n\n1. e4 e5 2. ### *\n",
+    "[FEN \"not a fen\"]\n\n1. e4 *\n",
+};
+
+// Runs |threads| parsers at once, each converting |pgn| |rounds| times with a
+// malformed input in between, and checks every conversion against
+// |reference|. Catches shared state in polyglot and in the conversion code,
+// and fatal errors that still end the process.
+bool check_concurrent_parsers(
+    const std::string& pgn,
+    const std::vector<lczero::V4TrainingData>& reference, int threads,
+    int rounds) {
+  std::atomic<int> mismatches{0};
+  std::atomic<int> syntax_errors{0};
+  std::atomic<int> other_errors{0};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      polyglot_init();
+      for (int round = 0; round < rounds; ++round) {
+        const char* malformed =
+            kMalformedPgn[(t + round) % (sizeof(kMalformedPgn) /
+                                         sizeof(kMalformedPgn[0]))];
+        try {
+          Converter converter;
+          converter.Convert(malformed, std::strlen(malformed),
+                            [](const TrainingDataBatch&) {});
+        } catch (const PolyglotError&) {
+          syntax_errors++;
+        } catch (const std::exception&) {
+          other_errors++;
+        }
+        try {
+          auto records = convert_in_process(pgn);
+          bool same = records.size() == reference.size();
+          for (size_t i = 0; same && i < records.size(); ++i) {
+            same = training_data_difference(reference[i], records[i]) < 0;
+          }
+          if (!same) mismatches++;
+        } catch (const std::exception&) {
+          other_errors++;
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) worker.join();
+  std::string name = "concurrent (" + std::to_string(threads) +
+                     " threads x " + std::to_string(rounds) + " rounds)";
+  if (mismatches > 0 || other_errors > 0) {
+    std::cout << "FAIL " << name << ": " << mismatches
+              << " conversions differ, " << other_errors
+              << " unexpected errors" << std::endl;
+    return false;
+  }
+  std::cout << "ok   " << name << ": " << syntax_errors
+            << " syntax errors caught" << std::endl;
+  return true;
+}
+
+// Every game of a parallel run must be written exactly once.
+bool check_game_ids(const std::string& name, std::vector<int> game_ids) {
+  std::sort(game_ids.begin(), game_ids.end());
+  auto duplicate = std::adjacent_find(game_ids.begin(), game_ids.end());
+  if (duplicate != game_ids.end()) {
+    std::cout << "FAIL " << name << ": game " << *duplicate
+              << " written more than once" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Converts all |pgn_filenames| at once with -parallel-files into game stream
+// files. Tiny directories make the readers interleave games of the same
+// directory, which must end up in numbered parts instead of overwriting
+// each other. |reference| holds the records of all files.
+bool check_parallel_files(const std::vector<std::string>& pgn_filenames,
+                          const std::vector<lczero::V4TrainingData>& reference,
+                          const std::string& directory) {
+  const Mode kGameStream = {"game-stream", OutputFormat::GAME_STREAM, 2, 0};
+  const size_t kGamesPerDirectory = 4;
+  std::string name =
+      "parallel-files game-stream (" +
+      std::to_string(pgn_filenames.size()) + " files)";
+  std::vector<int> game_ids;
+  auto records = convert_with(
+      kGameStream, directory,
+      [&](const Options& options, const ScoreToQ& score_to_q,
+          AsyncTrainingDataWriter* writer, ConversionStats* stats) {
+        convert_pgn_files_parallel(pgn_filenames, pgn_filenames.size(),
+                                   GameIdMode::PER_FILE_RANGES, options,
+                                   score_to_q, writer, stats, 0, SIZE_MAX);
+      },
+      kGamesPerDirectory, &game_ids);
+  return check_game_ids(name, game_ids) &&
+         compare_records(name, reference, records, false);
+}
+
+// Converts all |pgn_filenames| with -threads on |threads| threads, one game
+// per block so that the workers steal as much as possible, into game stream
+// files in tiny directories. Every game must be converted exactly once,
+// whoever ends up with its block.
+bool check_work_stealing(const std::vector<std::string>& pgn_filenames,
+                         const std::vector<lczero::V4TrainingData>& reference,
+                         int threads, const std::string& directory) {
+  const Mode kGameStream = {"game-stream", OutputFormat::GAME_STREAM, 2, 0};
+  const size_t kGamesPerDirectory = 4;
+  std::string name = "threads game-stream (" + std::to_string(threads) +
+                     " threads)";
+  WorkStealingConverter scheduler(pgn_filenames, SIZE_MAX, 0, 1);
+  std::vector<int> game_ids;
+  auto records = convert_with(
+      kGameStream, directory,
+      [&](const Options& options, const ScoreToQ& score_to_q,
+          AsyncTrainingDataWriter* writer, ConversionStats* stats) {
+        scheduler.Run(threads, options, score_to_q, writer, stats);
+      },
+      kGamesPerDirectory, &game_ids);
+  for (int id : game_ids) {
+    if (id < 0 || static_cast<size_t>(id) >= scheduler.games()) {
+      std::cout << "FAIL " << name << ": game id " << id << " out of range"
+                << std::endl;
+      return false;
+    }
+  }
+  if (!check_game_ids(name, game_ids)) return false;
+  if (!compare_records(name, reference, records, false)) return false;
+  std::cout << "ok   " << name << ": " << scheduler.steals() << " steals"
+            << std::endl;
+  return true;
+}
+
+// Submits games to a writer with a small pool in rounds and flushes after
+// each one, as -procs workers do after every range. Every game submitted
+// before a Flush() must be in its file when it returns.
+bool check_writer_flush(const std::string& directory) {
+  const int kRounds = 64;
+  const int kGamesPerRound = 7;
+  std::string games_directory = directory + "/supervised-0";
+  lczero::CreateDirectory(directory);
+  lczero::CreateDirectory(games_directory);
+  // Files of an earlier run would be counted.
+  for (const auto& file : lczero::GetFileList(games_directory)) {
+    std::remove((games_directory + "/" + file).c_str());
+  }
+  WriterOptions writer_options;
+  writer_options.output_directory = directory;
+  writer_options.pool_size = 2;
+  AsyncTrainingDataWriter writer(writer_options);
+  int game_id = 0;
+  for (int round = 0; round < kRounds; ++round) {
+    for (int i = 0; i < kGamesPerRound; ++i) {
+      GameRecords* game = writer.Acquire();
+      game->game_id = game_id++;
+      game->directory = "supervised-0";
+      game->records.resize(1);
+      writer.Submit(game);
+    }
+    writer.Flush();
+    size_t files = lczero::GetFileList(games_directory).size();
+    if (files != static_cast<size_t>(game_id)) {
+      std::cout << "FAIL writer flush: " << files << " files after round "
+                << round << ", " << game_id << " games submitted"
+                << std::endl;
+      writer.Finish();
+      return false;
+    }
+  }
+  writer.Finish();
+  std::cout << "ok   writer flush: " << kRounds << " rounds" << std::endl;
+  return true;
+}
+
+// Pushes every value from 1 to |values| exactly once through a small queue
+// from |threads| producers to as many consumers, in batches of varying size
+// and with slow consumers in between, so that both sides wait and sleep.
+// Every value must come out exactly once.
+bool check_mpmc_queue(int threads, uint32_t values) {
+  MpmcQueue<uint32_t> queue("verify", 16);
+  std::vector<std::atomic<uint8_t>> seen(values + 1);
+  for (auto& count : seen) count = 0;
+  std::vector<std::thread> producers;
+  for (int t = 0; t < threads; ++t) {
+    producers.emplace_back([&, t]() {
+      uint32_t batch[7];
+      size_t size = 0;
+      for (uint32_t value = 1 + t; value <= values; value += threads) {
+        batch[size++] = value;
+        if (size >= 1 + value % 7) {
+          queue.PushBatch(batch, size);
+          size = 0;
+        }
+      }
+      queue.PushBatch(batch, size);
+    });
+  }
+  std::vector<std::thread> consumers;
+  for (int t = 0; t < threads; ++t) {
+    consumers.emplace_back([&, t]() {
+      uint32_t batch[5];
+      size_t size;
+      while ((size = queue.PopBatch(batch, 1 + t % 5)) > 0) {
+        for (size_t i = 0; i < size; ++i) seen[batch[i]]++;
+        if (batch[0] % 4096 == 0) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+      }
+    });
+  }
+  for (auto& producer : producers) producer.join();
+  queue.Close();
+  for (auto& consumer : consumers) consumer.join();
+  std::string name = "mpmc queue (" + std::to_string(threads) +
+                     " producers and consumers)";
+  for (uint32_t value = 1; value <= values; ++value) {
+    if (seen[value] != 1) {
+      std::cout << "FAIL " << name << ": value " << value << " popped "
+                << static_cast<int>(seen[value]) << " times" << std::endl;
+      return false;
+    }
+  }
+  QueueMetrics metrics = queue.metrics();
+  std::cout << "ok   " << name << ": " << values << " values, "
+            << metrics.push_waits << " full and " << metrics.pop_waits
+            << " empty waits" << std::endl;
+  return true;
+}
+
+// Golden hashes, one "<pgn> <field> <hash>" line each. The "records" field
+// holds the record count.
+using GoldenHashes = std::map<std::string, std::string>;
+
+std::vector<std::pair<std::string, std::string>> golden_lines(
+    const std::string& pgn_name,
+    const std::vector<lczero::V4TrainingData>& records) {
+  TrainingDataHasher hasher;
+  for (const auto& record : records) hasher.Add(record);
+  std::vector<std::pair<std::string, std::string>> lines;
+  lines.emplace_back(pgn_name + " records", std::to_string(hasher.records()));
+  for (int i = 0; i < kTrainingDataFieldCount; ++i) {
+    std::ostringstream hash;
+    hash << std::hex << std::setw(16) << std::setfill('0') << hasher.hash(i);
+    lines.emplace_back(pgn_name + " " + training_data_field_name(i),
+                       hash.str());
+  }
+  return lines;
+}
+
+bool load_golden_hashes(const std::string& filename, GoldenHashes* golden) {
+  std::ifstream file(filename);
+  if (!file) return false;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    std::istringstream fields(line);
+    std::string pgn, field, value;
+    fields >> pgn >> field >> value;
+    (*golden)[pgn + " " + field] = value;
+  }
+  return true;
+}
+
+bool check_golden(const GoldenHashes& golden, const std::string& pgn_name,
+                  const std::vector<lczero::V4TrainingData>& records) {
+  bool ok = true;
+  for (const auto& line : golden_lines(pgn_name, records)) {
+    auto it = golden.find(line.first);
+    if (it == golden.end()) {
+      std::cout << "FAIL golden: no entry for " << line.first << std::endl;
+      ok = false;
+    } else if (it->second != line.second) {
+      std::cout << "FAIL golden: " << line.first << " is " << line.second
+                << ", expected " << it->second << std::endl;
+      ok = false;
+    }
+  }
+  if (ok) std::cout << "ok   golden: " << pgn_name << std::endl;
+  return ok;
+}
+
+// The regex parser doesn't read the depth, so only the score and the mate
+// flag are compared.
+bool same_eval(bool success_a, const EvalComment& a, bool success_b,
+               const EvalComment& b) {
+  if (success_a != success_b) return false;
+  if (!success_a) return true;
+  return std::memcmp(&a.score, &b.score, sizeof(a.score)) == 0 &&
+         a.mate == b.mate;
+}
+
+// parse_eval_comment() against the regex parser on every fishtest style
+// comment of |pgn_filename|.
+bool check_eval_comments(const std::string& pgn_filename) {
+  pgn_t pgn[1];
+  pgn_open(pgn, pgn_filename.c_str());
+  char str[256];
+  size_t comments = 0;
+  size_t mismatches = 0;
+  while (pgn_next_game(pgn)) {
+    while (pgn_next_move(pgn, str, 256)) {
+      const char* comment = pgn->last_read_comment;
+      // The regex parser only knows the fishtest forms.
+      if (!comment[0] || std::strstr(comment, "%eval")) continue;
+      comments++;
+      EvalComment fast, reference;
+      bool fast_ok = parse_eval_comment(comment, &fast);
+      bool reference_ok = parse_eval_comment_regex(comment, &reference);
+      if (!same_eval(fast_ok, fast, reference_ok, reference)) {
+        if (mismatches++ < 10) {
+          std::cout << "FAIL eval comment: \"" << comment << "\"" << std::endl;
+        }
+      }
+    }
+  }
+  pgn_close(pgn);
+  if (mismatches > 0) {
+    std::cout << "FAIL eval comment: " << mismatches << " of " << comments
+              << " comments differ" << std::endl;
+    return false;
+  }
+  std::cout << "ok   eval comment: " << comments << " comments" << std::endl;
+  return true;
+}
+
+// A random fishtest style comment: scores "x.yz/d" and mates "#n/d", either
+// sign, between junk and truncated numbers that must not be mistaken for a
+// score.
+std::string random_fishtest_comment(std::mt19937* rng) {
+  static const char* const kJunk[] = {
+      " ",  "book", "1.2s", "d=20", "+",  "-",  "#",   "/",  ".",   "M3",
+      "1.", "1./",  ".5/",  "-.5/", "#/", "#-", "#-/", "-/", "12",  "0.",
+      "--", "##",   "1.2",  "#3",   "/3", "x/", "1.-", "e5", "-0.", "3.0e2/"};
+  auto pick = [rng](uint32_t n) { return (*rng)() % n; };
+  auto digits = [&](uint32_t max_length) {
+    std::string result;
+    for (uint32_t i = 1 + pick(max_length); i > 0; i--) {
+      result += static_cast<char>('0' + pick(10));
+    }
+    return result;
+  };
+  std::string comment;
+  for (uint32_t parts = 1 + pick(4); parts > 0; parts--) {
+    switch (pick(4)) {
+      case 0:
+        comment += kJunk[pick(sizeof(kJunk) / sizeof(kJunk[0]))];
+        break;
+      case 1:
+        if (pick(2)) comment += "-";
+        comment += digits(3) + "." + digits(3) + "/";
+        if (pick(4)) comment += digits(2);
+        break;
+      case 2:
+        comment += pick(2) ? "#-" : "#";
+        comment += digits(3) + "/";
+        if (pick(4)) comment += digits(2);
+        break;
+      default:
+        // A number cut short anywhere.
+        std::string number =
+            (pick(2) ? "-" : "") + digits(3) + "." + digits(3) + "/" +
+            digits(2);
+        comment += number.substr(0, pick(number.size()));
+        break;
+    }
+  }
+  return comment;
+}
+
+// parse_eval_comment() against the regex parser on generated fishtest
+// comments, and on the Lichess forms, which only the scanner reads, against
+// expected results.
+bool check_eval_scanner() {
+  std::mt19937 rng(20);
+  const size_t kComments = 100000;
+  size_t matched = 0;
+  size_t mismatches = 0;
+  for (size_t i = 0; i < kComments; i++) {
+    std::string comment = random_fishtest_comment(&rng);
+    EvalComment fast, reference;
+    bool fast_ok = parse_eval_comment(comment.c_str(), &fast);
+    bool reference_ok = parse_eval_comment_regex(comment.c_str(), &reference);
+    if (fast_ok) matched++;
+    if (!same_eval(fast_ok, fast, reference_ok, reference)) {
+      if (mismatches++ < 10) {
+        std::cout << "FAIL eval scanner: \"" << comment << "\"" << std::endl;
+      }
+    }
+  }
+
+  const float kMate = 128.0f;
+  struct Case {
+    const char* comment;
+    bool ok;
+    float score;
+    int depth;
+    bool mate;
+  };
+  const Case kCases[] = {
+      {"[%eval 0.23]", true, 0.23f, -1, false},
+      {"[%eval -1.5]", true, -1.5f, -1, false},
+      {"[%eval +2]", true, 2.0f, -1, false},
+      {"[%eval 12]", true, 12.0f, -1, false},
+      {"[%eval  1.25]", true, 1.25f, -1, false},
+      {"[%eval 1.]", true, 1.0f, -1, false},
+      {"[%eval 0.17,25]", true, 0.17f, 25, false},
+      {"[%eval -0.4/18]", true, -0.4f, 18, false},
+      {"[%eval #3]", true, kMate, -1, true},
+      {"[%eval #-3]", true, -kMate, -1, true},
+      {"[%eval #+1]", true, kMate, -1, true},
+      {"[%eval #-2,30]", true, -kMate, 30, true},
+      {"[%clk 0:03:00] [%eval 0.3]", true, 0.3f, -1, false},
+      {"[%eval 0.3] [%clk 0:03:00]", true, 0.3f, -1, false},
+      {"Nice move [%eval -7.05] !", true, -7.05f, -1, false},
+      {"[%eval 0.5] +1.00/10", true, 0.5f, -1, false},
+      {"[%eval]", false, 0, -1, false},
+      {"[%eval ]", false, 0, -1, false},
+      {"[%eval -]", false, 0, -1, false},
+      {"[%eval #]", false, 0, -1, false},
+      {"[%eval #-]", false, 0, -1, false},
+      {"[%eval abc]", false, 0, -1, false},
+      {"[%eval", false, 0, -1, false},
+      {"[%eval x] -0.45/20", true, -0.45f, 20, false},
+      {"+0.45/20 1.2s", true, 0.45f, 20, false},
+      {"#-3/20", true, -kMate, 20, true},
+  };
+  for (const Case& c : kCases) {
+    EvalComment eval;
+    bool ok = parse_eval_comment(c.comment, &eval);
+    if (ok != c.ok || (ok && (eval.score != c.score || eval.depth != c.depth ||
+                              eval.mate != c.mate))) {
+      std::cout << "FAIL eval scanner: \"" << c.comment << "\"";
+      if (ok) {
+        std::cout << " read as " << eval.score << " depth " << eval.depth
+                  << (eval.mate ? " mate" : "");
+      } else {
+        std::cout << " not read";
+      }
+      std::cout << std::endl;
+      mismatches++;
+    }
+  }
+
+  if (mismatches > 0) {
+    std::cout << "FAIL eval scanner: " << mismatches << " comments differ"
+              << std::endl;
+    return false;
+  }
+  std::cout << "ok   eval scanner: " << kComments << " generated comments ("
+            << matched << " with a score), "
+            << sizeof(kCases) / sizeof(kCases[0]) << " Lichess cases"
+            << std::endl;
+  return true;
+}
+
+// The score to Q table against convert_sf_score_to_win_probability(), on
+// every centipawn and on scores between them.
+bool check_score_to_q() {
+  ScoreToQ score_to_q(logistic_score_model(kDefaultScoreScale));
+  size_t mismatches = 0;
+  size_t scores = 0;
+  for (int cp = -13000; cp <= 13000; ++cp) {
+    for (float offset : {0.0f, 0.003f}) {
+      float score = cp / 100.0f + offset;
+      float q = score_to_q.Convert(score);
+      float reference = convert_sf_score_to_win_probability(score);
+      scores++;
+      if (std::memcmp(&q, &reference, sizeof(q)) != 0 && mismatches++ < 10) {
+        std::cout << "FAIL score to Q: " << score << " gives " << q
+                  << ", expected " << reference << std::endl;
+      }
+    }
+  }
+  if (mismatches > 0) {
+    std::cout << "FAIL score to Q: " << mismatches << " of " << scores
+              << " scores differ" << std::endl;
+    return false;
+  }
+  std::cout << "ok   score to Q: " << scores << " scores" << std::endl;
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  lczero::InitializeMagicBitboards();
+  polyglot_init();
+  std::string golden_filename = "test/golden-hashes.txt";
+  std::string output_directory = "trainingdata-verify-output";
+  bool write_golden = false;
+  int stress_threads =
+      std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+  int stress_rounds = 4;
+  std::vector<std::string> files;
+  for (int idx = 1; idx < argc; ++idx) {
+    if (0 == static_cast<std::string>("-golden").compare(argv[idx])) {
+      golden_filename = argv[++idx];
+    } else if (0 ==
+               static_cast<std::string>("-write-golden").compare(argv[idx])) {
+      write_golden = true;
+    } else if (0 ==
+               static_cast<std::string>("-output-dir").compare(argv[idx])) {
+      output_directory = argv[++idx];
+    } else if (0 == static_cast<std::string>("-stress-threads")
+                        .compare(argv[idx])) {
+      stress_threads = std::atoi(argv[++idx]);
+    } else if (0 ==
+               static_cast<std::string>("-stress-rounds").compare(argv[idx])) {
+      stress_rounds = std::atoi(argv[++idx]);
+    } else {
+      files.push_back(argv[idx]);
+    }
+  }
+  if (files.empty()) {
+    files = {"test/2008_SCT_LadiesOpen.pgn", "test/output-test-test.pgn"};
+  }
+
+  GoldenHashes golden;
+  if (!write_golden && !load_golden_hashes(golden_filename, &golden)) {
+    std::cout << "FAIL golden: no golden hashes in " << golden_filename
+              << ", write them with -write-golden on a reviewed build"
+              << std::endl;
+    std::cout << "FAIL" << std::endl;
+    return 1;
+  }
+  std::ofstream golden_out;
+  if (write_golden) {
+    golden_out.open(golden_filename, std::ios::trunc);
+    golden_out << "# Written by trainingdata-verify -write-golden" << '\n';
+  }
+
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd))) throw lczero::Exception("getcwd failed");
+  lczero::CreateDirectory(output_directory);
+  bool ok = true;
+  std::vector<std::string> pgn_filenames;
+  std::vector<lczero::V4TrainingData> all_references;
+  for (const auto& file : files) {
+    std::string pgn_filename = file[0] == '/' ? file : cwd + ("/" + file);
+    pgn_filenames.push_back(pgn_filename);
+    std::string pgn_name = basename(file);
+    std::cout << "Verifying \'" << file << "\'" << std::endl;
+
+    std::vector<lczero::V4TrainingData> reference;
+    for (const auto& mode : kModes) {
+      std::string directory =
+          output_directory + "/" + pgn_name + "-" + mode.name;
+      auto records = convert(pgn_filename, mode, directory);
+      if (&mode == &kModes[0]) {
+        reference = records;
+        if (write_golden) {
+          for (const auto& line : golden_lines(pgn_name, reference)) {
+            golden_out << line.first << " " << line.second << '\n';
+          }
+        } else {
+          ok = check_golden(golden, pgn_name, reference) && ok;
+        }
+        continue;
+      }
+      ok = compare_records(mode.name, reference, records,
+                           mode.shuffle_buffer_size == 0) &&
+           ok;
+    }
+    all_references.insert(all_references.end(), reference.begin(),
+                          reference.end());
+    std::string pgn = read_text_file(pgn_filename);
+    ok = compare_records("converter", reference, convert_in_process(pgn),
+                         true) &&
+         ok;
+    ok = check_columns(pgn, reference) && ok;
+    ok = check_eval_comments(pgn_filename) && ok;
+    if (stress_threads > 0) {
+      ok = check_concurrent_parsers(pgn, reference, stress_threads,
+                                    stress_rounds) &&
+           ok;
+    }
+  }
+  ok = check_parallel_files(pgn_filenames, all_references,
+                            output_directory + "/parallel-files") &&
+       ok;
+  ok = check_work_stealing(pgn_filenames, all_references,
+                           std::max(stress_threads, 2),
+                           output_directory + "/threads") &&
+       ok;
+  ok = check_writer_flush(output_directory + "/writer-flush") && ok;
+  ok = check_mpmc_queue(std::max(stress_threads, 2), 1 << 20) && ok;
+  ok = check_eval_scanner() && ok;
+  ok = check_score_to_q() && ok;
+
+  if (write_golden) {
+    if (!golden_out) throw lczero::Exception("Cannot write " + golden_filename);
+    std::cout << "Golden hashes written to " << golden_filename << std::endl;
+  }
+  std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+  return ok ? 0 : 1;
+}